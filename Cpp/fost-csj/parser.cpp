@@ -10,22 +10,420 @@
 #include <fost/insert>
 #include <fost/exception/parse_error.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define FOST_CSJ_SSE2
+#endif
+
 
 namespace {
-    template<typename P, typename Iter, typename Vec>
-    inline void parseline(const P &parser, Iter &pos, Iter end, Vec &into) {
-        into.clear();
-        if (pos != end) {
-            auto line_pos = f5::cord::make_u32u16_iterator(
-                    (*pos).begin(), (*pos).end());
-            if (not boost::spirit::qi::parse(
-                        line_pos.first, line_pos.second, parser, into)
-                || line_pos.first != line_pos.second) {
-                throw fostlib::exceptions::parse_error{
-                        "Could not parse row", *pos};
+
+
+    /**
+     * ## Structural scanning
+     *
+     * A single pass over the body, in the style of simdjson, finds the
+     * bytes that matter to the CSJ structure 64 at a time. SSE2 is used to
+     * classify the bytes where it is available. Escapes and strings are
+     * then worked out for the whole block with bit operations, so that
+     * the commas and brackets outside of strings can be recorded in a
+     * bitmap along with the start of each line.
+     */
+
+
+    /// The bytes of interest in a block of 64, one bit for each byte
+    struct block_masks {
+        uint64_t newline = 0, comma = 0, quote = 0, backslash = 0,
+                 bracket = 0;
+    };
+
+
+#ifdef FOST_CSJ_SSE2
+    uint64_t matches(const __m128i (&chunks)[4], char const c) {
+        __m128i const wanted = _mm_set1_epi8(c);
+        uint64_t mask{};
+        for (std::size_t index{}; index < 4; ++index) {
+            unsigned const bits = _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(chunks[index], wanted));
+            mask |= uint64_t(bits) << (16 * index);
+        }
+        return mask;
+    }
+#endif
+
+
+    block_masks classify(const char *const block) {
+        block_masks m;
+#ifdef FOST_CSJ_SSE2
+        __m128i chunks[4];
+        for (std::size_t index{}; index < 4; ++index) {
+            chunks[index] = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(block + 16 * index));
+        }
+        m.newline = matches(chunks, '\n');
+        m.comma = matches(chunks, ',');
+        m.quote = matches(chunks, '"');
+        m.backslash = matches(chunks, '\\');
+        m.bracket = matches(chunks, '{') | matches(chunks, '[')
+                | matches(chunks, '}') | matches(chunks, ']');
+#else
+        for (std::size_t index{}; index < 64; ++index) {
+            uint64_t const bit = uint64_t(1) << index;
+            switch (block[index]) {
+            case '\n': m.newline |= bit; break;
+            case ',': m.comma |= bit; break;
+            case '"': m.quote |= bit; break;
+            case '\\': m.backslash |= bit; break;
+            case '{':
+            case '[':
+            case '}':
+            case ']': m.bracket |= bit; break;
+            }
+        }
+#endif
+        return m;
+    }
+
+
+    std::size_t lowest_bit(uint64_t const mask) {
+#ifdef __GNUC__
+        return __builtin_ctzll(mask);
+#else
+        std::size_t index{};
+        while (not(mask & (uint64_t(1) << index))) { ++index; }
+        return index;
+#endif
+    }
+
+
+    /// The bytes that come straight after an odd number of backslashes,
+    /// and so are escaped. `carry` is one if the block before ended part
+    /// way through an odd length run of backslashes.
+    uint64_t escaped(uint64_t const backslash, uint64_t &carry) {
+        constexpr uint64_t even = 0x5555555555555555u, odd = ~even;
+        uint64_t const starts = backslash & ~(backslash << 1);
+        uint64_t const even_start_mask = even ^ carry;
+        uint64_t const even_starts = starts & even_start_mask;
+        uint64_t const odd_starts = starts & ~even_start_mask;
+        uint64_t const even_carries = backslash + even_starts;
+        uint64_t const odd_sum = backslash + odd_starts;
+        uint64_t const odd_carries = odd_sum | carry;
+        carry = odd_sum < backslash ? 1u : 0u;
+        uint64_t const even_carry_ends = even_carries & ~backslash;
+        uint64_t const odd_carry_ends = odd_carries & ~backslash;
+        return (even_carry_ends & odd) | (odd_carry_ends & even);
+    }
+
+
+    /// Each bit is set if an odd number of the bits at or below it are
+    uint64_t prefix_xor(uint64_t bits) {
+        for (std::size_t shift{1}; shift < 64; shift *= 2) {
+            bits ^= bits << shift;
+        }
+        return bits;
+    }
+
+
+    /// Record the start of each line, and one past the end of the text,
+    /// together with the commas and brackets that aren't in strings
+    void index_text(
+            const char *const text,
+            std::size_t const size,
+            std::vector<std::size_t> &starts,
+            std::vector<uint64_t> &structure) {
+        starts.clear();
+        starts.push_back(0);
+        structure.assign((size + 63) / 64, 0);
+        uint64_t odd_backslashes{}, in_string{};
+        for (std::size_t offset{}; offset < size; offset += 64) {
+            block_masks m;
+            if (size - offset >= 64) {
+                m = classify(text + offset);
+            } else {
+                /// The padding is all zero bytes, which match nothing
+                char tail[64] = {};
+                std::memcpy(tail, text + offset, size - offset);
+                m = classify(tail);
+            }
+            uint64_t const quotes =
+                    m.quote & ~escaped(m.backslash, odd_backslashes);
+            uint64_t strings = prefix_xor(quotes) ^ in_string;
+            /// A string can't carry on over a new line, so a line with an
+            /// unbalanced quote (which the tokenizer will reject) doesn't
+            /// upset the lines after it
+            while (uint64_t const wrong = m.newline & strings) {
+                strings ^= ~uint64_t{} << lowest_bit(wrong);
+            }
+            in_string = (strings >> 63) ? ~uint64_t{} : 0u;
+            structure[offset / 64] = (m.comma | m.bracket) & ~strings;
+            for (uint64_t lines = m.newline; lines; lines &= lines - 1) {
+                starts.push_back(offset + lowest_bit(lines) + 1);
+            }
+        }
+        starts.push_back(size + 1);
+    }
+
+
+    /// Find the first quote, backslash or control character
+    const char *string_special(const char *pos, const char *const end) {
+#ifdef FOST_CSJ_SSE2
+        __m128i const quote = _mm_set1_epi8('"');
+        __m128i const backslash = _mm_set1_epi8('\\');
+        __m128i const control = _mm_set1_epi8(0x1f);
+        for (; end - pos >= 16; pos += 16) {
+            __m128i const block =
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+            /// Unsigned bytes no bigger than 0x1f are control characters
+            __m128i const found = _mm_or_si128(
+                    _mm_or_si128(
+                            _mm_cmpeq_epi8(block, quote),
+                            _mm_cmpeq_epi8(block, backslash)),
+                    _mm_cmpeq_epi8(_mm_max_epu8(block, control), control));
+            if (unsigned const mask = _mm_movemask_epi8(found); mask) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for (; pos != end; ++pos) {
+            auto const c = static_cast<unsigned char>(*pos);
+            if (c == '"' || c == '\\' || c < 0x20) { return pos; }
+        }
+        return end;
+    }
+
+
+    /// Tokenizes a single line of CSJ directly from the UTF-8 bytes. Plain
+    /// strings, integers and the JSON literals are handled here. Anything
+    /// else (strings with escapes, floats, nested objects and arrays) has
+    /// its extent found here and is then handed to the JSON parser.
+    class tokenizer {
+        f5::u8view text;
+        const char *const begin;
+        const char *pos;
+        const char *const end;
+        std::size_t row;
+        /// The start of the whole body and its structural bitmap
+        const char *const body;
+        const uint64_t *const structure;
+
+      public:
+        tokenizer(
+                f5::u8view line,
+                std::size_t r,
+                const char *b,
+                const std::vector<uint64_t> &s)
+        : text(line),
+          begin(line.data()),
+          pos(begin),
+          end(begin + line.bytes()),
+          row(r),
+          body(b),
+          structure(s.data()) {}
+
+        template<typename Vec>
+        void values(Vec &into) {
+            skip_spaces();
+            if (pos == end) { return; }
+            while (true) {
+                into.push_back(value());
+                skip_spaces();
+                if (pos == end) {
+                    return;
+                } else if (*pos == ',') {
+                    ++pos;
+                    skip_spaces();
+                } else {
+                    error("Expected a comma between values");
+                }
+            }
+        }
+
+      private:
+        [[noreturn]] void error(const char *message) const {
+            fostlib::exceptions::parse_error e{message, text};
+            /// The column counts code points, not bytes
+            std::size_t column{1};
+            for (auto p = begin; p != pos; ++p) {
+                if ((*p & 0xc0) != 0x80) { ++column; }
+            }
+            fostlib::insert(e.data(), "csj", "line", int64_t(row));
+            fostlib::insert(e.data(), "csj", "column", int64_t(column));
+            throw e;
+        }
+
+        void skip_spaces() {
+            /// A carriage return is allowed so files with DOS line endings
+            /// can be read
+            while (pos != end
+                   && (*pos == ' ' || *pos == '\t' || *pos == '\r')) {
+                ++pos;
+            }
+        }
+
+        static fostlib::string as_string(const char *b, const char *e) {
+            /// Converting from `utf8_string` checks that the UTF-8 is valid
+            return fostlib::coerce<fostlib::string>(
+                    fostlib::utf8_string{std::string(b, e)});
+        }
+
+        fostlib::json parse_span(const char *start) {
+            try {
+                return fostlib::json::parse(as_string(start, pos));
+            } catch (fostlib::exceptions::exception &) {
+                pos = start;
+                error("Invalid JSON value");
+            }
+        }
+
+        fostlib::json value() {
+            if (pos == end) { error("Expected a value"); }
+            switch (*pos) {
+            case '"': return string();
+            case '-':
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9': return number();
+            case 'n': return literal("null", fostlib::json{});
+            case 't': return literal("true", fostlib::json{true});
+            case 'f': return literal("false", fostlib::json{false});
+            case '{':
+            case '[': return nested();
+            default: error("Unexpected character");
+            }
+        }
+
+        fostlib::json string() {
+            const char *const start = pos++;
+            bool escaped = false;
+            while (true) {
+                pos = string_special(pos, end);
+                if (pos == end) {
+                    pos = start;
+                    error("String is not terminated");
+                } else if (*pos == '"') {
+                    break;
+                } else if (*pos == '\\') {
+                    escaped = true;
+                    if (++pos != end) { ++pos; }
+                } else {
+                    error("Control character in string");
+                }
+            }
+            ++pos;
+            if (escaped) {
+                return parse_span(start);
+            } else {
+                try {
+                    return fostlib::json{as_string(start + 1, pos - 1)};
+                } catch (fostlib::exceptions::exception &) {
+                    pos = start;
+                    error("String is not valid UTF-8");
+                }
             }
         }
+
+        fostlib::json number() {
+            const char *const start = pos;
+            bool const negative = (*pos == '-');
+            if (negative) { ++pos; }
+            int64_t n{};
+            std::size_t digits{};
+            while (pos != end && *pos >= '0' && *pos <= '9') {
+                n = n * 10 + (*pos - '0');
+                ++digits;
+                ++pos;
+            }
+            if (digits == 0) {
+                pos = start;
+                error("Expected a digit");
+            }
+            bool const integer =
+                    (pos == end || (*pos != '.' && *pos != 'e' && *pos != 'E'));
+            /// Eighteen digits always fit in an `int64_t`
+            if (integer && digits <= 18) {
+                return fostlib::json{negative ? -n : n};
+            }
+            while (pos != end
+                   && ((*pos >= '0' && *pos <= '9') || *pos == '.'
+                       || *pos == 'e' || *pos == 'E' || *pos == '+'
+                       || *pos == '-')) {
+                ++pos;
+            }
+            return parse_span(start);
+        }
+
+        fostlib::json literal(f5::u8view word, fostlib::json v) {
+            auto const length = word.bytes();
+            if (std::size_t(end - pos) < length
+                || std::string_view{pos, length}
+                        != std::string_view{word.data(), length}) {
+                error("Unknown literal");
+            }
+            pos += length;
+            return v;
+        }
+
+        /// The next comma or bracket that isn't in a string, at or after
+        /// `from`, or `end` if there are no more on the line
+        const char *structural(const char *const from) const {
+            std::size_t offset = from - body;
+            std::size_t const last = end - body;
+            while (offset < last) {
+                uint64_t const bits = structure[offset / 64]
+                        & (~uint64_t{} << (offset % 64));
+                if (bits) {
+                    offset = offset - offset % 64 + lowest_bit(bits);
+                    break;
+                }
+                offset = offset - offset % 64 + 64;
+            }
+            return body + std::min(offset, last);
+        }
+
+        /// Only the brackets need looking at to find the end of the value,
+        /// the strings inside it are skipped over by the bitmap
+        fostlib::json nested() {
+            const char *const start = pos;
+            std::size_t depth{};
+            for (auto p = structural(pos); p != end; p = structural(p + 1)) {
+                if (*p == '{' || *p == '[') {
+                    ++depth;
+                } else if (*p == '}' || *p == ']') {
+                    if (--depth == 0) {
+                        pos = p + 1;
+                        return parse_span(start);
+                    }
+                }
+            }
+            pos = start;
+            error("Object or array is not closed");
+        }
+    };
+
+
+    template<typename Vec>
+    inline void parseline(
+            f5::u8view line,
+            std::size_t const row,
+            f5::u8view body,
+            const std::vector<uint64_t> &structure,
+            Vec &into) {
+        into.clear();
+        tokenizer{line, row, body.data(), structure}.values(into);
     }
+
+
 }
 
 
@@ -34,23 +432,63 @@ namespace {
 */
 
 
-fostlib::csj::parser::parser(f5::u8view str)
-: line_iter(splitter(str, '\n')),
-  li_pos(line_iter.begin()),
-  li_end(line_iter.end()) {
-    parseline(headers_p, li_pos, li_end, headers);
-    if (not headers.size()) {
+fostlib::csj::parser::parser(f5::u8view str) : text(str) {
+    index_text(text.data(), text.bytes(), line_starts, structure);
+    std::vector<json> names;
+    parseline(line(0), 1u, text, structure, names);
+    if (not names.size()) {
         throw exceptions::parse_error{"No headers were found when parsing CSJ"};
     }
-    ++li_pos;
+    headers.reserve(names.size());
+    for (const auto &name : names) {
+        auto const header = coerce<nullable<f5::u8view>>(name);
+        if (not header) {
+            exceptions::parse_error e{"Headers must be strings", line(0)};
+            insert(e.data(), "csj", "header", name);
+            throw e;
+        }
+        headers.emplace_back(*header);
+    }
+}
+
+
+f5::u8view fostlib::csj::parser::line(std::size_t const index) const {
+    auto const start = line_starts[index];
+    return f5::u8view{
+            text.data() + start, line_starts[index + 1] - 1u - start};
+}
+
+
+std::vector<fostlib::json>
+        fostlib::csj::parser::parse_row(std::size_t const row) const {
+    std::vector<json> values;
+    parseline(line(row + 1u), row + 2u, text, structure, values);
+    if (values.size() && values.size() != headers.size()) {
+        fostlib::exceptions::not_implemented e{
+                __func__, "Number of columns didn't match number of headers",
+                values};
+        insert(e.data(), "csj", "line", int64_t(row + 2u));
+        throw e;
+    }
+    return values;
+}
+
+
+fostlib::json fostlib::csj::parser::as_json(
+        const std::vector<json> &values) const {
+    fostlib::json row;
+    for (std::size_t c{}; c != values.size(); ++c) {
+        fostlib::insert(row, headers[c], values[c]);
+    }
+    return row;
 }
 
 
 fostlib::csj::parser::const_iterator fostlib::csj::parser::begin() const {
-    return fostlib::csj::parser::const_iterator(*this, li_pos);
+    return fostlib::csj::parser::const_iterator(*this, 1u);
 }
 fostlib::csj::parser::const_iterator fostlib::csj::parser::end() const {
-    return fostlib::csj::parser::const_iterator(*this, li_end);
+    return fostlib::csj::parser::const_iterator(*this, lines());
 }
 
 
@@ -60,37 +498,55 @@ fostlib::csj::parser::const_iterator fostlib::csj::parser::end() const {
 
 
 fostlib::csj::parser::const_iterator::const_iterator(
-        const parser &o, line_iter_t::const_iterator p)
+        const parser &o, std::size_t p)
 : owner(o), pos(p) {
-    parseline(owner.line_p, pos, owner.li_end, line);
+    if (pos < owner.lines()) {
+        parseline(
+                owner.line(pos), pos + 1u, owner.text, owner.structure,
+                line);
+        if (not line.size()) { only_blank_lines(); }
+    }
 }
 
 
 fostlib::csj::parser::const_iterator &
         fostlib::csj::parser::const_iterator::operator++() {
-    parseline(owner.line_p, ++pos, owner.li_end, line);
+    line.clear();
+    if (++pos < owner.lines()) {
+        parseline(
+                owner.line(pos), pos + 1u, owner.text, owner.structure,
+                line);
+    }
     if (not line.size()) {
-        // We've hit a blank line. Make sure we only get them from now on
-        while (pos != owner.li_end) {
-            parseline(owner.line_p, ++pos, owner.li_end, line);
-            if (line.size()) {
-                throw exceptions::parse_error{
-                        "Empty line embedded in CSJ file"};
-            }
-        }
+        only_blank_lines();
     } else if (line.size() != owner.header().size()) {
-        throw fostlib::exceptions::not_implemented(
+        fostlib::exceptions::not_implemented e{
                 __func__, "Number of columns didn't match number of headers",
-                line);
+                line};
+        insert(e.data(), "csj", "line", int64_t(pos + 1u));
+        throw e;
     }
     return *this;
 }
 
 
-fostlib::json fostlib::csj::parser::const_iterator::as_json() const {
-    fostlib::json row;
-    for (std::size_t c{}; c != line.size(); ++c) {
-        fostlib::insert(row, owner.header()[c], line[c]);
+void fostlib::csj::parser::const_iterator::only_blank_lines() {
+    // We've hit a blank line. Make sure we only get them from now on
+    while (pos < owner.lines()) {
+        if (++pos < owner.lines()) {
+            parseline(
+                    owner.line(pos), pos + 1u, owner.text, owner.structure,
+                    line);
+        }
+        if (line.size()) {
+            exceptions::parse_error e{"Empty line embedded in CSJ file"};
+            insert(e.data(), "csj", "line", int64_t(pos + 1u));
+            throw e;
+        }
     }
-    return row;
+}
+
+
+fostlib::json fostlib::csj::parser::const_iterator::as_json() const {
+    return owner.as_json(line);
 }
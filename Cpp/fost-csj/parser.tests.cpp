@@ -7,6 +7,7 @@
 
 
 #include <fost/csj.parser.hpp>
+#include <fost/exception/parse_error.hpp>
 #include <fost/test>
 
 
@@ -98,3 +99,125 @@ FSL_TEST_FUNCTION(two_lines_and_spaces) {
     FSL_CHECK_EQ(*(iter++), fostlib::json(10));
     FSL_CHECK(iter == line.end());
 }
+
+
+FSL_TEST_FUNCTION(value_types) {
+    fostlib::utf8_string str(
+            "\"h1\",\"h2\",\"h3\",\"h4\",\"h5\",\"h6\",\"h7\"\n"
+            "null, true,false ,-12,1.5,\"a\\\"b\",{\"x\":[1,\"]\"]}");
+    fostlib::csj::parser csj(str);
+    auto line = *(csj.begin());
+    FSL_CHECK_EQ(line.size(), 7u);
+    FSL_CHECK_EQ(line[0], fostlib::json());
+    FSL_CHECK_EQ(line[1], fostlib::json(true));
+    FSL_CHECK_EQ(line[2], fostlib::json(false));
+    FSL_CHECK_EQ(line[3], fostlib::json(-12));
+    FSL_CHECK_EQ(line[4], fostlib::json(1.5));
+    FSL_CHECK_EQ(line[5], fostlib::json("a\"b"));
+    FSL_CHECK_EQ(line[6], fostlib::json::parse("{\"x\":[1,\"]\"]}"));
+}
+
+
+FSL_TEST_FUNCTION(large_integers) {
+    fostlib::utf8_string str(
+            "\"h1\",\"h2\"\n1234567890123456789,-1234567890123456789");
+    fostlib::csj::parser csj(str);
+    auto line = *(csj.begin());
+    FSL_CHECK_EQ(line[0], fostlib::json(int64_t(1234567890123456789)));
+    FSL_CHECK_EQ(line[1], fostlib::json(int64_t(-1234567890123456789)));
+}
+
+
+FSL_TEST_FUNCTION(error_position) {
+    fostlib::utf8_string str("\"h1\",\"h2\"\n1,2\n\"\xc3\xa9\",x");
+    fostlib::csj::parser csj(str);
+    auto line = csj.begin();
+    try {
+        ++line;
+        FSL_CHECK(false);
+    } catch (fostlib::exceptions::parse_error &e) {
+        FSL_CHECK_EQ(e.data()["csj"]["line"], fostlib::json(3));
+        FSL_CHECK_EQ(e.data()["csj"]["column"], fostlib::json(5));
+    }
+}
+
+
+FSL_TEST_FUNCTION(headers_must_be_strings) {
+    fostlib::utf8_string str("\"h1\",2\n1,2");
+    FSL_CHECK_EXCEPTION(
+            fostlib::csj::parser{str}, fostlib::exceptions::parse_error &);
+}
+
+
+FSL_TEST_FUNCTION(long_lines) {
+    std::string str{"\"h1\",\"h2\"\n"};
+    std::string const long_text(100, 'x');
+    for (std::size_t row{}; row != 20; ++row) {
+        str += "\"" + long_text + "\"," + std::to_string(row) + "\n";
+    }
+    fostlib::utf8_string const body{str};
+    fostlib::csj::parser csj(body);
+    std::size_t rows{};
+    for (auto line = csj.begin(); line != csj.end(); ++line, ++rows) {
+        FSL_CHECK_EQ((*line)[0], fostlib::json(long_text.c_str()));
+        FSL_CHECK_EQ((*line)[1], fostlib::json(int64_t(rows)));
+    }
+    FSL_CHECK_EQ(rows, 20u);
+}
+
+
+FSL_TEST_FUNCTION(nested_strings_with_structure) {
+    fostlib::utf8_string str(
+            "\"h1\",\"h2\"\n"
+            "{\"a,\":\"}]\\\\\",\"b\":[\"\\\"[\"]},[[1],{\"c\":\"{\"}]");
+    fostlib::csj::parser csj(str);
+    auto line = *(csj.begin());
+    FSL_CHECK_EQ(line.size(), 2u);
+    FSL_CHECK_EQ(
+            line[0],
+            fostlib::json::parse("{\"a,\":\"}]\\\\\",\"b\":[\"\\\"[\"]}"));
+    FSL_CHECK_EQ(line[1], fostlib::json::parse("[[1],{\"c\":\"{\"}]"));
+}
+
+
+FSL_TEST_FUNCTION(nested_across_blocks) {
+    /// The values and strings start and finish on either side of the
+    /// 64 byte blocks the structure is indexed in
+    std::string str{"\"h1\",\"h2\"\n"};
+    std::vector<std::string> values;
+    for (std::size_t pad{}; pad != 70; ++pad) {
+        std::string const text(2 * pad, '\\');
+        values.push_back(
+                "{\"" + std::string(pad, 'x') + "\":[\"" + text
+                + "\",\"]\"]}");
+        str += values.back() + "," + std::to_string(pad) + "\n";
+    }
+    fostlib::utf8_string const body{str};
+    fostlib::csj::parser csj(body);
+    std::size_t rows{};
+    for (auto line = csj.begin(); line != csj.end(); ++line, ++rows) {
+        FSL_CHECK_EQ(
+                (*line)[0], fostlib::json::parse(values[rows].c_str()));
+        FSL_CHECK_EQ((*line)[1], fostlib::json(int64_t(rows)));
+    }
+    FSL_CHECK_EQ(rows, 70u);
+}
+
+
+FSL_TEST_FUNCTION(unterminated_string_stays_on_its_line) {
+    fostlib::utf8_string str("\"h1\",\"h2\"\n[\"a],1\n[\"b\"],2\n");
+    fostlib::csj::parser csj(str);
+    FSL_CHECK_EXCEPTION(csj.parse_row(0), fostlib::exceptions::parse_error &);
+    auto const row = csj.parse_row(1);
+    FSL_CHECK_EQ(row.size(), 2u);
+    FSL_CHECK_EQ(row[0], fostlib::json::parse("[\"b\"]"));
+    FSL_CHECK_EQ(row[1], fostlib::json(2));
+}
+
+
+FSL_TEST_FUNCTION(embedded_blank_line) {
+    fostlib::utf8_string str("\"h1\"\n1\n\n2\n");
+    fostlib::csj::parser csj(str);
+    auto line = csj.begin();
+    FSL_CHECK_EXCEPTION(++line, fostlib::exceptions::parse_error &);
+}
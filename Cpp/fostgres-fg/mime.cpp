@@ -133,6 +133,38 @@ void fg::assert_comparable(
                     __func__, "Found extra row in the actual data",
                     actual_iter.as_json());
         }
+    } else if (
+            actual.headers()["Content-Type"].value()
+            == "application/x-ndjson") {
+        /// Each line is checked against the matching item of the expected
+        /// array
+        auto const actual_data = body_data(actual);
+        std::string const text(actual_data.begin(), actual_data.end());
+        auto expected_body = mime_to_json(expected);
+        std::size_t index{}, start{};
+        while (start < text.size()) {
+            auto end = text.find('\n', start);
+            if (end == std::string::npos) { end = text.size(); }
+            auto const line = fostlib::json::parse(
+                    fostlib::coerce<fostlib::string>(fostlib::utf8_string{
+                            text.substr(start, end - start)}));
+            start = end + 1;
+            if (index >= expected_body.size()) {
+                throw fostlib::exceptions::not_implemented(
+                        __func__, "Found extra row in the actual data", line);
+            }
+            auto contains = fg::contains(line, expected_body[index]);
+            if (contains) {
+                throw_contains_error(
+                        line, expected_body[index], contains.value());
+            }
+            ++index;
+        }
+        if (index != expected_body.size()) {
+            throw fostlib::exceptions::not_implemented(
+                    __func__, "Found extra row in the expected data",
+                    expected_body[index]);
+        }
     } else {
         throw fostlib::exceptions::not_implemented(
                 __func__, "MIME type",
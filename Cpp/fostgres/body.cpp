@@ -0,0 +1,330 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "body.hpp"
+
+#include <fost/insert>
+#include <fost/exception/parse_error.hpp>
+
+#include <cctype>
+#include <charconv>
+#include <cstring>
+
+
+namespace {
+    /// Returns the first byte that doesn't start a valid UTF-8 sequence,
+    /// or `end` if they are all valid
+    const unsigned char *
+            invalid_utf8(const unsigned char *p, const unsigned char *end) {
+        while (p != end) {
+            /// Plain ASCII is checked eight bytes at a time
+            if (end - p >= 8) {
+                uint64_t word;
+                std::memcpy(&word, p, sizeof(word));
+                if (not(word & 0x8080808080808080u)) {
+                    p += 8;
+                    continue;
+                }
+            }
+            auto const c = *p;
+            if (c < 0x80) {
+                ++p;
+                continue;
+            }
+            std::size_t following{};
+            uint32_t cp{};
+            if ((c & 0xe0) == 0xc0) {
+                following = 1;
+                cp = c & 0x1f;
+            } else if ((c & 0xf0) == 0xe0) {
+                following = 2;
+                cp = c & 0x0f;
+            } else if ((c & 0xf8) == 0xf0) {
+                following = 3;
+                cp = c & 0x07;
+            } else {
+                return p;
+            }
+            if (std::size_t(end - p) <= following) { return p; }
+            for (std::size_t index{1}; index <= following; ++index) {
+                if ((p[index] & 0xc0) != 0x80) { return p; }
+                cp = (cp << 6) | (p[index] & 0x3f);
+            }
+            /// Over-long encodings, surrogates and values past the end of
+            /// Unicode aren't allowed
+            if ((following == 1 && cp < 0x80)
+                || (following == 2 && cp < 0x800)
+                || (following == 3 && cp < 0x10000) || cp > 0x10ffff
+                || (cp >= 0xd800 && cp <= 0xdfff)) {
+                return p;
+            }
+            p += following + 1;
+        }
+        return end;
+    }
+
+    bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+}
+
+
+f5::u8view fostgres::validate_utf8(const char *bytes, std::size_t size) {
+    auto const begin = reinterpret_cast<const unsigned char *>(bytes);
+    if (auto const bad = invalid_utf8(begin, begin + size);
+        bad != begin + size) {
+        fostlib::exceptions::parse_error e{"Body is not valid UTF-8"};
+        fostlib::insert(e.data(), "position", int64_t(bad - begin));
+        throw e;
+    }
+    return f5::u8view{bytes, size};
+}
+
+
+f5::u8view
+        fostgres::request_text(const fostlib::http::server::request &req) {
+    auto const &bytes = req.data()->data();
+    return validate_utf8(
+            reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+
+namespace {
+    /// Deeper nesting than this is refused rather than risk the stack
+    constexpr std::size_t c_max_depth = 512;
+
+    /// Parses JSON straight from UTF-8 text that has already been
+    /// validated, so strings can be copied out as they are
+    class json_reader {
+      public:
+        json_reader(const char *b, const char *e) : pos(b), end(e) {}
+
+        fostlib::json document() {
+            skip_space();
+            auto result = value(0);
+            skip_space();
+            if (pos != end) { fail(); }
+            return result;
+        }
+
+        [[noreturn]] void fail() const {
+            throw fostlib::exceptions::parse_error(
+                    "Could not parse JSON request body",
+                    fostlib::string{std::string(pos, end)});
+        }
+
+      private:
+        const char *pos, *end;
+
+        void skip_space() {
+            while (pos != end && is_space(*pos)) { ++pos; }
+        }
+        bool next_is(char c) {
+            skip_space();
+            if (pos != end && *pos == c) {
+                ++pos;
+                return true;
+            } else {
+                return false;
+            }
+        }
+        void expect(char c) {
+            if (not next_is(c)) { fail(); }
+        }
+        void literal(std::string_view word) {
+            if (std::size_t(end - pos) < word.size()
+                || std::string_view{pos, word.size()} != word) {
+                fail();
+            }
+            pos += word.size();
+        }
+
+        fostlib::json value(std::size_t const depth) {
+            if (depth > c_max_depth || pos == end) { fail(); }
+            switch (*pos) {
+            case '{': return object(depth);
+            case '[': return array(depth);
+            case '"': return fostlib::json{fostlib::string{string()}};
+            case 't': literal("true"); return fostlib::json{true};
+            case 'f': literal("false"); return fostlib::json{false};
+            case 'n': literal("null"); return fostlib::json{};
+            default: return number();
+            }
+        }
+
+        fostlib::json object(std::size_t const depth) {
+            ++pos;
+            fostlib::json::object_t members;
+            if (next_is('}')) { return fostlib::json{std::move(members)}; }
+            do {
+                skip_space();
+                if (pos == end || *pos != '"') { fail(); }
+                fostlib::string key{string()};
+                expect(':');
+                skip_space();
+                members[key] = value(depth + 1);
+            } while (next_is(','));
+            expect('}');
+            return fostlib::json{std::move(members)};
+        }
+
+        fostlib::json array(std::size_t const depth) {
+            ++pos;
+            fostlib::json::array_t items;
+            if (next_is(']')) { return fostlib::json{std::move(items)}; }
+            do {
+                skip_space();
+                items.push_back(value(depth + 1));
+            } while (next_is(','));
+            expect(']');
+            return fostlib::json{std::move(items)};
+        }
+
+        fostlib::json number() {
+            const char *const start = pos;
+            bool integral = true;
+            if (pos != end && *pos == '-') { ++pos; }
+            if (pos == end || not std::isdigit(static_cast<unsigned char>(*pos))
+                || (*pos == '0' && pos + 1 != end
+                    && std::isdigit(static_cast<unsigned char>(pos[1])))) {
+                fail();
+            }
+            auto const digits = [&]() {
+                const char *const first = pos;
+                while (pos != end
+                       && std::isdigit(static_cast<unsigned char>(*pos))) {
+                    ++pos;
+                }
+                if (pos == first) { fail(); }
+            };
+            digits();
+            if (pos != end && *pos == '.') {
+                integral = false;
+                ++pos;
+                digits();
+            }
+            if (pos != end && (*pos == 'e' || *pos == 'E')) {
+                integral = false;
+                ++pos;
+                if (pos != end && (*pos == '+' || *pos == '-')) { ++pos; }
+                digits();
+            }
+            if (integral) {
+                int64_t i{};
+                if (auto const r = std::from_chars(start, pos, i);
+                    r.ec == std::errc{} && r.ptr == pos) {
+                    return fostlib::json{i};
+                }
+            }
+            /// Integers too big for 64 bits end up here as well
+            double d{};
+            if (auto const r = std::from_chars(start, pos, d);
+                r.ec != std::errc{} || r.ptr != pos) {
+                pos = start;
+                fail();
+            }
+            return fostlib::json{d};
+        }
+
+        /// The text of a string, with the escapes turned into UTF-8
+        std::string string() {
+            ++pos;
+            std::string text;
+            while (true) {
+                const char *const run = pos;
+                while (pos != end && *pos != '"' && *pos != '\\'
+                       && static_cast<unsigned char>(*pos) >= 0x20) {
+                    ++pos;
+                }
+                text.append(run, pos);
+                if (pos == end || static_cast<unsigned char>(*pos) < 0x20) {
+                    fail();
+                } else if (*pos == '"') {
+                    ++pos;
+                    return text;
+                }
+                ++pos;
+                if (pos == end) { fail(); }
+                switch (*pos++) {
+                case '"': text += '"'; break;
+                case '\\': text += '\\'; break;
+                case '/': text += '/'; break;
+                case 'b': text += '\b'; break;
+                case 'f': text += '\f'; break;
+                case 'n': text += '\n'; break;
+                case 'r': text += '\r'; break;
+                case 't': text += '\t'; break;
+                case 'u': append_utf8(text, escaped_code_point()); break;
+                default: --pos; fail();
+                }
+            }
+        }
+
+        uint32_t hex4() {
+            if (end - pos < 4) { fail(); }
+            uint32_t cp{};
+            for (std::size_t index{}; index < 4; ++index, ++pos) {
+                auto const c = *pos;
+                cp <<= 4;
+                if (c >= '0' && c <= '9') {
+                    cp |= c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    cp |= c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    cp |= c - 'A' + 10;
+                } else {
+                    fail();
+                }
+            }
+            return cp;
+        }
+        /// Reads the hex digits after a `\u`, including the second half
+        /// of a surrogate pair
+        uint32_t escaped_code_point() {
+            auto const high = hex4();
+            if (high >= 0xdc00 && high <= 0xdfff) {
+                fail();
+            } else if (high < 0xd800 || high > 0xdbff) {
+                return high;
+            }
+            if (end - pos < 2 || pos[0] != '\\' || pos[1] != 'u') { fail(); }
+            pos += 2;
+            auto const low = hex4();
+            if (low < 0xdc00 || low > 0xdfff) { fail(); }
+            return 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00);
+        }
+        static void append_utf8(std::string &into, uint32_t const cp) {
+            if (cp < 0x80) {
+                into += char(cp);
+            } else if (cp < 0x800) {
+                into += char(0xc0 | (cp >> 6));
+                into += char(0x80 | (cp & 0x3f));
+            } else if (cp < 0x10000) {
+                into += char(0xe0 | (cp >> 12));
+                into += char(0x80 | ((cp >> 6) & 0x3f));
+                into += char(0x80 | (cp & 0x3f));
+            } else {
+                into += char(0xf0 | (cp >> 18));
+                into += char(0x80 | ((cp >> 12) & 0x3f));
+                into += char(0x80 | ((cp >> 6) & 0x3f));
+                into += char(0x80 | (cp & 0x3f));
+            }
+        }
+    };
+}
+
+
+fostlib::json fostgres::parse_json(f5::u8view const text) {
+    return json_reader{text.data(), text.data() + text.bytes()}.document();
+}
+
+
+fostlib::json
+        fostgres::request_json(const fostlib::http::server::request &req) {
+    return parse_json(request_text(req));
+}
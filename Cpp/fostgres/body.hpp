@@ -0,0 +1,38 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fost/http.server.hpp>
+
+
+namespace fostgres {
+
+
+    /**
+     * ## Request bodies
+     *
+     * The body is used where it is in the request, without being copied.
+     */
+
+
+    /// The request body as text. Throws a `parse_error` if it isn't valid
+    /// UTF-8
+    f5::u8view request_text(const fostlib::http::server::request &);
+    /// Check that the bytes are valid UTF-8
+    f5::u8view validate_utf8(const char *bytes, std::size_t size);
+
+    /// Parse the request body as JSON
+    fostlib::json request_json(const fostlib::http::server::request &);
+    /// Parse JSON directly from UTF-8 text that has already been checked
+    /// by `validate_utf8`
+    fostlib::json parse_json(f5::u8view);
+
+
+}
@@ -0,0 +1,84 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "body.hpp"
+#include <fost/exception/parse_error.hpp>
+#include <fost/insert>
+#include <fost/push_back>
+#include <fost/test>
+
+
+FSL_TEST_SUITE(body);
+
+
+namespace {
+    f5::u8view check(std::string_view s) {
+        return fostgres::validate_utf8(s.data(), s.size());
+    }
+    fostlib::json parse(std::string_view s) {
+        return parse(f5::u8view{s.data(), s.size()});
+    }
+}
+
+
+FSL_TEST_FUNCTION(valid_utf8) {
+    FSL_CHECK_EQ(check(""), "");
+    FSL_CHECK_EQ(check("plain ASCII text"), "plain ASCII text");
+    FSL_CHECK_EQ(check("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"),
+                 "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80");
+}
+
+
+FSL_TEST_FUNCTION(invalid_utf8) {
+    /// Truncated sequence
+    FSL_CHECK_EXCEPTION(
+            check("abc\xc3"), fostlib::exceptions::parse_error &);
+    /// Stray continuation byte after enough ASCII to use the fast path
+    FSL_CHECK_EXCEPTION(
+            check("0123456789\x80"), fostlib::exceptions::parse_error &);
+    /// Over-long encoding of '/'
+    FSL_CHECK_EXCEPTION(
+            check("\xc0\xaf"), fostlib::exceptions::parse_error &);
+    /// UTF-16 surrogate
+    FSL_CHECK_EXCEPTION(
+            check("\xed\xa0\x80"), fostlib::exceptions::parse_error &);
+}
+
+
+FSL_TEST_FUNCTION(parse_json) {
+    FSL_CHECK_EQ(parse(" null "), fostlib::json{});
+    FSL_CHECK_EQ(parse("true"), fostlib::json{true});
+    FSL_CHECK_EQ(parse("-42"), fostlib::json{int64_t(-42)});
+    FSL_CHECK_EQ(parse("2.5e1"), fostlib::json{25.0});
+    FSL_CHECK_EQ(
+            parse("\"caf\xc3\xa9 \\u00e9\\n\\ud83d\\ude00\""),
+            fostlib::json{"caf\xc3\xa9 \xc3\xa9\n\xf0\x9f\x98\x80"});
+
+    fostlib::json expected;
+    fostlib::insert(expected, "a", int64_t(1));
+    fostlib::push_back(expected, "b", fostlib::json{});
+    fostlib::push_back(expected, "b", "x");
+    fostlib::insert(expected, "c", fostlib::json::object_t{});
+    FSL_CHECK_EQ(
+            parse("{\"a\": 1, \"b\": [null, \"x\"], \"c\": {}}"), expected);
+}
+
+
+FSL_TEST_FUNCTION(parse_json_errors) {
+    FSL_CHECK_EXCEPTION(parse(""), fostlib::exceptions::parse_error &);
+    FSL_CHECK_EXCEPTION(
+            parse("{\"a\": 1,}"), fostlib::exceptions::parse_error &);
+    FSL_CHECK_EXCEPTION(parse("[1] 2"), fostlib::exceptions::parse_error &);
+    FSL_CHECK_EXCEPTION(parse("012"), fostlib::exceptions::parse_error &);
+    /// A lone surrogate can't be turned into UTF-8
+    FSL_CHECK_EXCEPTION(
+            parse("\"\\ud83d\""), fostlib::exceptions::parse_error &);
+    /// Too deeply nested
+    FSL_CHECK_EXCEPTION(
+            parse(std::string(1000, '[')), fostlib::exceptions::parse_error &);
+}
@@ -11,8 +11,6 @@
 #include <fostgres/matcher.hpp>
 #include <fostgres/response.hpp>
 
-#include <fost/log>
-
 
 namespace {
     const fostlib::json c_file("file");
@@ -49,71 +47,6 @@ namespace {
         }
         return fostlib::json{redacted};
     }
-
-    fostlib::nullable<fostlib::json> proc_datum(
-            const fostlib::json &jsource,
-            const std::vector<fostlib::string> &arguments,
-            const fostlib::json &row,
-            const fostlib::http::server::request &req) {
-        if (jsource.isarray()) {
-            auto source = fostlib::coerce<fostlib::jcursor>(jsource);
-            if (source.size()) {
-                fostlib::jcursor subpath(++source.begin(), source.end());
-                if (source[0] == "request") {
-                    auto val = req[subpath];
-                    if (val && subpath.size() >= 2 && subpath[0] == "headers"
-                        && ieq("authorization",
-                               fostlib::coerce<std::optional<fostlib::string>>(
-                                       subpath[1])
-                                       .value_or(fostlib::string{}))) {
-                        return header_redaction(subpath.size(), *val);
-                    } else {
-                        return val;
-                    }
-                } else if (source[0] == "body" && row.has_key(subpath)) {
-                    return row[subpath];
-                }
-            }
-            return fostlib::null;
-        } else {
-            auto n = fostlib::coerce<fostlib::nullable<std::size_t>>(
-                    jsource.get<int64_t>());
-            if (n) {
-                if (n.value() > 0 && n.value() <= arguments.size()) {
-                    return fostlib::json(arguments[n.value() - 1]);
-                }
-            } else {
-                auto s =
-                        fostlib::coerce<fostlib::nullable<f5::u8view>>(jsource);
-                if (s && row.has_key(s.value())) { return row[s.value()]; }
-            }
-        }
-        return fostlib::null;
-    }
-
-    fostlib::nullable<fostlib::json> call_datum(
-            const fostlib::string &name,
-            const fostlib::json &defn,
-            const std::vector<fostlib::string> &arguments,
-            const fostlib::json &row,
-            const fostlib::http::server::request &req) {
-        auto logger = fostlib::log::debug(fostgres::c_fostgres);
-        logger("", "Datum lookup")("in", "name", name)("in", "defn", defn)(
-                "in", "row", row);
-        if (defn["type"] == c_file) {
-            return fostgres::file_upload(name, defn, row);
-        } else if (defn["source"].isnull()) {
-            if (row.has_key(name)) {
-                logger("found", "name", name);
-                logger("found", "value", row[name]);
-                return row[name];
-            }
-            logger("not-found", name);
-        } else {
-            return proc_datum(defn["source"], arguments, row, req);
-        }
-        return fostlib::null;
-    }
 }
 
 
@@ -122,7 +55,12 @@ fostlib::nullable<fostlib::json> fostgres::datum(
         const std::vector<fostlib::string> &arguments,
         const fostlib::json &row,
         const fostlib::http::server::request &req) {
-    auto value = proc_datum(jsource, arguments, row, req);
+    // Without a source a column is looked up by its name, and there
+    // isn't one here
+    if (jsource.isnull()) { return fostlib::null; }
+    fostlib::json defn;
+    fostlib::insert(defn, "source", jsource);
+    auto value = column_source{{}, defn}(arguments, row, req);
     if (not value) {
         return value;
     } else {
@@ -140,13 +78,113 @@ fostlib::nullable<fostlib::json> fostgres::datum(
         const std::vector<fostlib::string> &arguments,
         const fostlib::json &row,
         const fostlib::http::server::request &req) {
-    auto value = call_datum(name, defn, arguments, row, req);
+    return column_source{name, defn}(arguments, row, req);
+}
+
+
+/**
+ * ## `fostgres::column_source`
+ */
+
+
+fostgres::column_source::column_source(
+        fostlib::string n, const fostlib::json &defn)
+: name(std::move(n)), trim(defn["trim"] != fostlib::json(false)) {
+    auto const &jsource = defn["source"];
+    if (defn["type"] == c_file) {
+        tag = kind::file;
+        definition = defn;
+    } else if (jsource.isnull()) {
+        tag = kind::body_key;
+        key = name;
+    } else if (jsource.isarray()) {
+        auto source = fostlib::coerce<fostlib::jcursor>(jsource);
+        if (source.size()) {
+            path = fostlib::jcursor(++source.begin(), source.end());
+            if (source[0] == "request") {
+                tag = kind::request;
+                redact = path.size() >= 2 && path[0] == "headers"
+                        && ieq("authorization",
+                               fostlib::coerce<std::optional<fostlib::string>>(
+                                       path[1])
+                                       .value_or(fostlib::string{}));
+            } else if (source[0] == "body") {
+                tag = kind::body_path;
+            }
+        }
+    } else if (auto const n = jsource.get<int64_t>(); n) {
+        if (*n > 0) {
+            tag = kind::argument;
+            argument = *n;
+        }
+    } else if (auto const s =
+                       fostlib::coerce<fostlib::nullable<f5::u8view>>(jsource);
+               s) {
+        tag = kind::body_key;
+        key = fostlib::string{*s};
+    }
+}
+
+
+fostlib::nullable<fostlib::json> fostgres::column_source::find(
+        const std::vector<fostlib::string> &arguments,
+        const fostlib::json &row,
+        const fostlib::http::server::request *req) const {
+    switch (tag) {
+    case kind::none: break;
+    case kind::body_key:
+        if (row.has_key(key)) { return row[key]; }
+        break;
+    case kind::body_path:
+        if (row.has_key(path)) { return row[path]; }
+        break;
+    case kind::request:
+        if (not req) {
+            throw fostlib::exceptions::not_implemented(
+                    __PRETTY_FUNCTION__,
+                    "The column's source needs the request", name);
+        } else if (auto val = (*req)[path]; val && redact) {
+            return header_redaction(path.size(), *val);
+        } else {
+            return val;
+        }
+    case kind::argument:
+        if (argument <= arguments.size()) {
+            return fostlib::json(arguments[argument - 1]);
+        }
+        break;
+    case kind::file:
+        if (not req) {
+            throw fostlib::exceptions::not_implemented(
+                    __PRETTY_FUNCTION__,
+                    "File uploads can't be handled without the request", name);
+        }
+        return file_upload(name, definition, row);
+    }
+    return fostlib::null;
+}
+
+
+fostlib::nullable<fostlib::json> fostgres::column_source::operator()(
+        const std::vector<fostlib::string> &arguments,
+        const fostlib::json &row,
+        const fostlib::http::server::request &req) const {
+    return trimmed(find(arguments, row, &req));
+}
+fostlib::nullable<fostlib::json> fostgres::column_source::operator()(
+        const std::vector<fostlib::string> &arguments,
+        const fostlib::json &row) const {
+    return trimmed(find(arguments, row, nullptr));
+}
+
+
+fostlib::nullable<fostlib::json> fostgres::column_source::trimmed(
+        fostlib::nullable<fostlib::json> value) const {
     if (not value) return value;
     auto const str = fostlib::coerce<std::optional<f5::u8view>>(value.value());
-    if (str && defn["trim"] != fostlib::json(false)) {
-        auto result = fostlib::coerce<std::optional<fostlib::json>>(
+    if (str && trim) {
+        return fostlib::coerce<std::optional<fostlib::json>>(
                 fostlib::trim(str));
-        return result;
     } else {
         return value;
     }
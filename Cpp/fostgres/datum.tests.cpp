@@ -125,3 +125,29 @@ FSL_TEST_FUNCTION(trim_config_false) {
                     body, fostlib::http::server::request("POST", "/")),
             fostlib::json("\u2008\u0020text\uFEFF\u3000"));
 }
+
+
+FSL_TEST_FUNCTION(column_source_argument) {
+    fostlib::json defn;
+    fostlib::insert(defn, "source", 2);
+    fostgres::column_source const source{"film", defn};
+    fostlib::http::server::request req("PUT", "/");
+    std::vector<fostlib::string> const args{"first", " second "};
+    FSL_CHECK_EQ(
+            source(args, fostlib::json{}, req).value(),
+            fostlib::json("second"));
+    FSL_CHECK(not source({"first"}, fostlib::json{}, req));
+}
+
+
+FSL_TEST_FUNCTION(column_source_body_path) {
+    fostlib::json defn, body;
+    fostlib::push_back(defn, "source", "body");
+    fostlib::push_back(defn, "source", "film");
+    fostlib::push_back(defn, "source", "title");
+    fostlib::insert(body, "film", "title", "Alien");
+    fostgres::column_source const source{"title", defn};
+    fostlib::http::server::request req("PUT", "/");
+    FSL_CHECK_EQ(source({}, body, req).value(), fostlib::json("Alien"));
+    FSL_CHECK(not source({}, fostlib::json{}, req));
+}
@@ -0,0 +1,84 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "encode.hpp"
+
+#include <fost/json>
+
+#include <charconv>
+
+
+namespace {
+    void append_integer(std::string &into, int64_t const value) {
+        char buffer[24];
+        auto const end =
+                std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+        into.append(buffer, end);
+    }
+
+    /// Printable ASCII apart from the quote and backslash is written out
+    /// the same by every JSON unparser
+    bool plain_json(f5::u8view text) {
+        for (const char *p = text.data(), *e = p + text.bytes(); p != e; ++p) {
+            auto const c = static_cast<unsigned char>(*p);
+            if (c < 0x20 || c > 0x7e || c == '"' || c == '\\') { return false; }
+        }
+        return true;
+    }
+}
+
+
+void fostgres::encode_json(std::string &into, const fostlib::json &cell) {
+    if (cell.isnull()) {
+        into += "null";
+    } else if (auto const b = cell.get<bool>(); b) {
+        into += *b ? "true" : "false";
+    } else if (auto const i = cell.get<int64_t>(); i) {
+        append_integer(into, *i);
+    } else if (auto const s = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                       cell);
+               s && plain_json(*s)) {
+        into += '"';
+        into.append(s->data(), s->bytes());
+        into += '"';
+    } else {
+        fostlib::json::unparse(into, cell, false);
+    }
+}
+
+
+void fostgres::encode_csv(std::string &into, const fostlib::json &cell) {
+    if (cell.isnull()) {
+        // Do nothing -- null is an empty entry
+    } else if (auto const b = cell.get<bool>(); b) {
+        into += *b ? "true" : "false";
+    } else if (auto const i = cell.get<int64_t>(); i) {
+        append_integer(into, *i);
+    } else if (auto const s = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                       cell);
+               s) {
+        encode_csv(into, *s);
+    } else {
+        encode_csv(into, f5::u8view{fostlib::json::unparse(cell, false)});
+    }
+}
+
+
+void fostgres::encode_csv(std::string &into, f5::u8view text) {
+    std::string_view const str{text.data(), text.bytes()};
+    if (str.find_first_of("\"\n,") != std::string_view::npos) {
+        into += '"';
+        for (auto ch : str) {
+            if (ch == '"') { into += ch; } // Double up this one
+            into += ch;
+        }
+        into += '"';
+    } else {
+        into += str;
+    }
+}
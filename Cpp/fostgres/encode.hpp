@@ -0,0 +1,39 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fost/core>
+
+#include <string>
+
+
+namespace fostgres {
+
+
+    /**
+     * ## Cell encoding
+     *
+     * Append database values to an output buffer. The common types (nulls,
+     * booleans, integers and plain text) are written directly into the
+     * buffer. Anything else goes through the JSON unparser. The output is
+     * always the same as `fostlib::json::unparse` would give.
+     */
+
+
+    /// Append the cell as JSON, as used for CSJ
+    void encode_json(std::string &into, const fostlib::json &cell);
+    /// Append the cell as a CSV field. Null is an empty field and strings
+    /// are written without JSON quoting
+    void encode_csv(std::string &into, const fostlib::json &cell);
+    /// Append text as a CSV field, quoting it only if needed
+    void encode_csv(std::string &into, f5::u8view text);
+
+
+}
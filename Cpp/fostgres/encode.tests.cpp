@@ -0,0 +1,54 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "encode.hpp"
+#include <fost/insert>
+#include <fost/test>
+
+
+FSL_TEST_SUITE(encode);
+
+
+namespace {
+    std::string as_json(const fostlib::json &cell) {
+        std::string out;
+        fostgres::encode_json(out, cell);
+        return out;
+    }
+    std::string as_csv(const fostlib::json &cell) {
+        std::string out;
+        fostgres::encode_csv(out, cell);
+        return out;
+    }
+}
+
+
+FSL_TEST_FUNCTION(json_matches_unparse) {
+    fostlib::json object;
+    fostlib::insert(object, "key", "value");
+    for (const auto &cell :
+         {fostlib::json{}, fostlib::json{true}, fostlib::json{false},
+          fostlib::json{int64_t{-1234567890123}}, fostlib::json{3.5},
+          fostlib::json{"plain"}, fostlib::json{"quote \" and \\"},
+          fostlib::json{"new\nline"}, fostlib::json{"caf\xc3\xa9"},
+          object}) {
+        std::string expected;
+        fostlib::json::unparse(expected, cell, false);
+        FSL_CHECK_EQ(as_json(cell), expected);
+    }
+}
+
+
+FSL_TEST_FUNCTION(csv) {
+    FSL_CHECK_EQ(as_csv(fostlib::json{}), "");
+    FSL_CHECK_EQ(as_csv(fostlib::json{true}), "true");
+    FSL_CHECK_EQ(as_csv(fostlib::json{int64_t{42}}), "42");
+    FSL_CHECK_EQ(as_csv(fostlib::json{"plain"}), "plain");
+    FSL_CHECK_EQ(as_csv(fostlib::json{"a,b"}), "\"a,b\"");
+    FSL_CHECK_EQ(as_csv(fostlib::json{"say \"hi\""}), "\"say \"\"hi\"\"\"");
+}
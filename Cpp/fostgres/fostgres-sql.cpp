@@ -7,12 +7,23 @@
 
 
 #include <fost/insert>
+#include <fost/log>
 #include <fost/push_back>
 
-#include <fostgres/matcher.hpp>
+#include <fostgres/fostgres.hpp>
+#include <fostgres/plan.hpp>
+#include <fostgres/pool.hpp>
 #include <fostgres/response.hpp>
 #include <fostgres/sql.hpp>
+#include <fostgres/statements.hpp>
+#include "log.hpp"
 #include "precondition.hpp"
+#include "replicas.hpp"
+#include "shards.hpp"
+
+#include <pqxx/except>
+
+#include <optional>
 
 
 namespace {
@@ -27,47 +38,90 @@ namespace {
                 const fostlib::string &path,
                 fostlib::http::server::request &req,
                 const fostlib::host &host) const {
-            auto m = fostgres::matcher(configuration["sql"], path);
+            fostgres::refresh_debug_logging();
+            auto const plan = fostgres::view_plan::compiled(configuration);
+            auto m = plan->matcher(path);
             if (m) {
-                fostlib::pg::connection cnx{
-                        fostgres::connection(configuration, req)};
-                if (m.value().configuration.has_key("precondition")) {
-                    fostlib::json precondition_config =
-                            m.value().configuration["precondition"];
-                    fostlib::json precondition_predicates;
-                    if (precondition_config.isobject()) {
-                        precondition_predicates = precondition_config["check"];
-                    } else {
-                        precondition_predicates = precondition_config;
-                    }
-                    auto stack = fostgres::preconditions({req, *m, &cnx});
-                    const auto res =
-                            fsigma::call(stack, precondition_predicates);
-                    if (res.isnull()) {
-                        // precondition predicate result is Falsy
-                        if (precondition_config.isobject()
-                            && precondition_config.has_key("failed")) {
-                            return execute(
-                                    precondition_config["failed"], path, req,
-                                    host);
-                        }
-                        /// Fallback to 403
-                        fostlib::json config;
-                        fostlib::insert(config, "view", "fost.response.403");
-                        return execute(config, path, req, host);
-                    }
-                }
                 try {
-                    return fostgres::response(cnx, configuration, *m, req);
-                } catch (fostlib::exceptions::exception &e) {
-                    fostlib::insert(
-                            e.data(), "view", "matched", m->configuration);
-                    throw;
+                    return respond(configuration, *plan, *m, path, req, host);
+                } catch (pqxx::sql_error &e) {
+                    if (not fostgres::statement_cache::stale(e)) { throw; }
+                    /// The failed transaction has been rolled back and the
+                    /// stale statements thrown away, so the request can be
+                    /// run once more from the start
+                    fostlib::log::info(fostgres::c_fostgres)(
+                            "", "Retrying after stale prepared statements")(
+                            "sqlstate", e.sqlstate());
+                    return respond(configuration, *plan, *m, path, req, host);
                 }
             }
             throw fostlib::exceptions::not_implemented(
                     __PRETTY_FUNCTION__, "No match found -- should be 404");
         }
+
+      private:
+        std::pair<boost::shared_ptr<fostlib::mime>, int> respond(
+                const fostlib::json &configuration,
+                const fostgres::view_plan &plan,
+                fostgres::match &m,
+                const fostlib::string &path,
+                fostlib::http::server::request &req,
+                const fostlib::host &host) const {
+            auto const &endpoint = m.plan();
+            std::optional<fostgres::pooled_connection> lease;
+            try {
+                lease.emplace(fostgres::connect(configuration, plan, m, req));
+            } catch (fostgres::unknown_shard &) {
+                fostlib::json config;
+                fostlib::insert(config, "view", "fost.response.404");
+                return execute(config, path, req, host);
+            } catch (fostgres::pool_exhausted &e) {
+                fostlib::log::warning(fostgres::c_fostgres)(
+                        "", "No database connection available")(
+                        "error", e.data());
+                fostlib::json config;
+                fostlib::insert(config, "view", "fost.response.503");
+                return execute(config, path, req, host);
+            }
+            m.lease = &lease;
+            fostlib::pg::connection &cnx = **lease;
+            if (endpoint.has_precondition) {
+                auto stack = fostgres::preconditions({req, m, &cnx});
+                const auto res = fsigma::call(stack, endpoint.precondition);
+                if (res.isnull()) {
+                    /// The precondition only reads so the connection can go
+                    /// straight back to the pool
+                    lease->release();
+                    // precondition predicate result is Falsy
+                    if (not endpoint.precondition_failed.isnull()) {
+                        return execute(
+                                endpoint.precondition_failed, path, req, host);
+                    }
+                    /// Fallback to 403
+                    fostlib::json config;
+                    fostlib::insert(config, "view", "fost.response.403");
+                    return execute(config, path, req, host);
+                }
+            }
+            try {
+                auto response = fostgres::response(cnx, configuration, m, req);
+                /// Reads and failed writes are rolled back. A streamed
+                /// response has already taken the lease for its body
+                if (not lease) {
+                    return response;
+                } else if (
+                        req.method() != "GET" && req.method() != "HEAD"
+                        && response.second < 400) {
+                    lease->commit();
+                } else {
+                    lease->release();
+                }
+                return response;
+            } catch (fostlib::exceptions::exception &e) {
+                fostlib::insert(e.data(), "view", "matched", m.configuration);
+                throw;
+            }
+        }
     } c_fostgres_sql;
 
 
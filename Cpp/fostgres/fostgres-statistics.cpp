@@ -0,0 +1,39 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fostgres/statements.hpp>
+
+#include <fost/insert>
+#include <fost/urlhandler>
+
+
+namespace {
+
+
+    const class fostgres_statistics : public fostlib::urlhandler::view {
+      public:
+        fostgres_statistics() : view("fostgres.statistics") {}
+
+        std::pair<boost::shared_ptr<fostlib::mime>, int> operator()(
+                const fostlib::json &,
+                const fostlib::string &,
+                fostlib::http::server::request &,
+                const fostlib::host &) const {
+            fostlib::json stats;
+            fostlib::insert(
+                    stats, "statements",
+                    fostgres::statement_cache::statistics());
+            boost::shared_ptr<fostlib::mime> response(new fostlib::text_body(
+                    fostlib::json::unparse(stats, true),
+                    fostlib::mime::mime_headers(), "application/json"));
+            return std::make_pair(response, 200);
+        }
+    } c_fostgres_statistics;
+
+
+}
@@ -0,0 +1,52 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "layout.hpp"
+
+#include <fost/json>
+
+#include <algorithm>
+
+
+fostgres::column_layout::column_layout(
+        const std::vector<fostlib::string> &columns) {
+    for (std::size_t index{}; index < columns.size(); ++index) {
+        if (columns[index].endswith("__tableoid")) continue;
+        auto const parts = fostlib::split(columns[index], "__");
+        if (parts.size()) { add(members, parts, 0, index); }
+    }
+}
+
+
+void fostgres::column_layout::add(
+        std::vector<member> &into,
+        const std::vector<fostlib::string> &path,
+        std::size_t const part,
+        std::size_t const column) {
+    auto const &name = path[part];
+    bool const leaf = (part + 1 == path.size());
+    /// Keep the members in key order, as a JSON object would have them
+    auto pos = std::lower_bound(
+            into.begin(), into.end(), name,
+            [](const member &m, const fostlib::string &n) {
+                return m.name < n;
+            });
+    if (pos == into.end() || pos->name != name) {
+        member m{name, {}, {}, {}};
+        fostlib::json::unparse(m.key, fostlib::json{name}, false);
+        m.key += ':';
+        if (leaf) { m.column = column; }
+        pos = into.insert(pos, std::move(m));
+    } else if (leaf || pos->column) {
+        throw fostlib::exceptions::not_implemented(
+                __PRETTY_FUNCTION__,
+                "Column name clashes with another column",
+                fostlib::json{name});
+    }
+    if (not leaf) { add(pos->children, path, part + 1, column); }
+}
@@ -0,0 +1,99 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include "encode.hpp"
+
+#include <fost/core>
+#include <fost/insert>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+
+namespace fostgres {
+
+
+    /// Describes how the columns of a result are turned into a JSON object.
+    /// A column name with `__` in it is nested, so `film__title` becomes
+    /// the `title` key inside the `film` object. Columns ending in
+    /// `__tableoid` are left out. The layout is worked out once for each
+    /// response from the column names and then used for every row.
+    class column_layout {
+      public:
+        explicit column_layout(const std::vector<fostlib::string> &columns);
+
+        /// Append the row to the buffer as a JSON object. The keys are in
+        /// the same order as `fostlib::json::unparse` gives them.
+        template<typename Row>
+        void encode(std::string &into, const Row &row) const {
+            encode(into, row, members);
+        }
+
+        /// Build the row as a JSON object
+        template<typename Row>
+        fostlib::json object(const Row &row) const {
+            return object(row, members);
+        }
+
+      private:
+        struct member {
+            fostlib::string name;
+            /// The key already encoded as JSON, including the colon
+            std::string key;
+            /// The column for a value, empty for a nested object
+            std::optional<std::size_t> column;
+            std::vector<member> children;
+        };
+        std::vector<member> members;
+
+        static void
+                add(std::vector<member> &,
+                    const std::vector<fostlib::string> &path,
+                    std::size_t part,
+                    std::size_t column);
+
+        template<typename Row>
+        static void encode(
+                std::string &into,
+                const Row &row,
+                const std::vector<member> &members) {
+            into += '{';
+            for (std::size_t index{}; index < members.size(); ++index) {
+                if (index) { into += ','; }
+                auto const &m = members[index];
+                into += m.key;
+                if (m.column) {
+                    encode_json(into, row[*m.column]);
+                } else {
+                    encode(into, row, m.children);
+                }
+            }
+            into += '}';
+        }
+
+        template<typename Row>
+        static fostlib::json
+                object(const Row &row, const std::vector<member> &members) {
+            fostlib::json result{fostlib::json::object_t()};
+            for (auto const &m : members) {
+                if (m.column) {
+                    fostlib::insert(result, m.name, row[*m.column]);
+                } else {
+                    fostlib::insert(result, m.name, object(row, m.children));
+                }
+            }
+            return result;
+        }
+    };
+
+
+}
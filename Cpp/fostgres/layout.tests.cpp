@@ -0,0 +1,46 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "layout.hpp"
+#include <fost/test>
+
+
+FSL_TEST_SUITE(layout);
+
+
+namespace {
+    const std::vector<fostlib::string> c_columns{
+            "slug", "film__title", "film__tableoid", "film__year", "id"};
+    const std::vector<fostlib::json> c_row{
+            fostlib::json{"alien"}, fostlib::json{"Alien"},
+            fostlib::json{int64_t{1234}}, fostlib::json{int64_t{1979}},
+            fostlib::json{int64_t{1}}};
+}
+
+
+FSL_TEST_FUNCTION(encode_matches_object) {
+    fostgres::column_layout const layout{c_columns};
+    std::string encoded;
+    layout.encode(encoded, c_row);
+    auto const object = layout.object(c_row);
+    FSL_CHECK_EQ(encoded, fostlib::json::unparse(object, false));
+    FSL_CHECK_EQ(object["film"]["title"], fostlib::json{"Alien"});
+    FSL_CHECK(not object["film"].has_key("tableoid"));
+    FSL_CHECK_EQ(object["id"], fostlib::json{int64_t{1}});
+}
+
+
+FSL_TEST_FUNCTION(clashing_columns) {
+    FSL_CHECK_EXCEPTION(
+            fostgres::column_layout(
+                    std::vector<fostlib::string>{"film", "film__title"}),
+            fostlib::exceptions::not_implemented &);
+    FSL_CHECK_EXCEPTION(
+            fostgres::column_layout(std::vector<fostlib::string>{"a", "a"}),
+            fostlib::exceptions::not_implemented &);
+}
@@ -0,0 +1,22 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "log.hpp"
+
+
+const fostlib::setting<bool> fostgres::c_debug_logging(
+        "fostgres/log.cpp", "fostgres", "Debug logging", true, true);
+
+
+std::atomic<bool> fostgres::detail::g_debug_logging{true};
+
+
+void fostgres::refresh_debug_logging() {
+    detail::g_debug_logging.store(
+            c_debug_logging.value(), std::memory_order_relaxed);
+}
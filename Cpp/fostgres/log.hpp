@@ -0,0 +1,53 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fostgres/fostgres.hpp>
+
+#include <fost/log>
+
+#include <atomic>
+
+
+namespace fostgres {
+
+
+    /// Turns off the debug log messages written for every SQL statement
+    /// and batch. It is read at the start of each request, so it can be
+    /// changed while the server is running.
+    extern const fostlib::setting<bool> c_debug_logging;
+
+    namespace detail {
+        extern std::atomic<bool> g_debug_logging;
+    }
+
+    /// Copy the current value of `c_debug_logging` into the flag that
+    /// `debug_logging` reads
+    void refresh_debug_logging();
+
+    /// True if the debug log messages are to be built
+    inline bool debug_logging() {
+        return detail::g_debug_logging.load(std::memory_order_relaxed);
+    }
+
+
+    /// Log a debug message. The function is passed the logger and is only
+    /// called when debug logging is on, so the values being logged are
+    /// never built when it is off. Building with
+    /// `FOSTGRES_NO_DEBUG_LOGGING` defined removes these messages.
+    template<typename F>
+    void log_debug(F &&f) {
+#ifndef FOSTGRES_NO_DEBUG_LOGGING
+        if (debug_logging()) { f(fostlib::log::debug(c_fostgres)); }
+#endif
+    }
+
+
+}
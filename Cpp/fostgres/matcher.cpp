@@ -8,60 +8,40 @@
 
 #include <fostgres/fostgres.hpp>
 #include <fostgres/matcher.hpp>
+#include <fostgres/plan.hpp>
+#include <fostgres/pool.hpp>
 
-#include <fost/log>
-#include <fost/string>
+
+fostlib::nullable<fostgres::match> fostgres::matcher(
+        const fostlib::json &configuration, const fostlib::string &path) {
+    /// The `fostgres.sql` view uses the cached plan for the whole view
+    /// configuration. This is for callers that only have the `sql` part.
+    return view_plan{configuration}.matcher(f5::u8view{path});
+}
+
+
+/**
+ * ## `fostgres::match`
+ */
 
 
-namespace {
-    fostlib::nullable<fostgres::match>
-            check(const fostlib::json &conf, const fostlib::split_type &parts) {
-        if (not conf.has_key("path")) return fostlib::null;
-        const fostlib::json &o = conf["path"];
-        if (o.size() == parts.size()) {
-            fostgres::match m{conf};
-            for (std::size_t index{0}; index < o.size(); ++index) {
-                auto s = fostlib::coerce<fostlib::string>(o[index]);
-                if (s.starts_with("/")) {
-                    if (parts[index]
-                        != (static_cast<f5::u8view>(s)).substr(1)) {
-                        return fostlib::null;
-                    }
-                } else {
-                    const auto n = fostlib::coerce<unsigned int>(o[index]);
-                    if (n > 0) {
-                        // We have a numeric match so this path part needs to
-                        // be exposed as argument number n. This entails
-                        // placing it at position (n-1) in the arguments array
-                        if (n > m.arguments.size()) { m.arguments.resize(n); }
-                        m.arguments[n - 1] = fostlib::coerce<fostlib::string>(
-                                fostlib::url::filepath_string(parts[index]));
-                    } else {
-                        throw fostlib::exceptions::not_implemented(
-                                __FUNCTION__,
-                                "Path arguments numbers cannot be zero");
-                    }
-                }
-            }
-            return m;
-        }
-        fostlib::log::debug(fostgres::c_fostgres)("", "Path size mismatch")(
-                "o", "size", o.size())("parts", "size", parts.size());
-        return fostlib::null;
+fostgres::pooled_connection *
+        fostgres::match::lease_for(const fostlib::pg::connection &cnx) const {
+    if (lease && *lease && (*lease)->leases(cnx)) {
+        return &**lease;
+    } else {
+        return nullptr;
     }
 }
 
 
-fostlib::nullable<fostgres::match> fostgres::matcher(
-        const fostlib::json &configuration, const fostlib::string &path) {
-    auto parts = fostlib::split(path, "/");
-    if (configuration.isobject()) {
-        return check(configuration, parts);
-    } else if (configuration.isarray()) {
-        for (auto conf : configuration) {
-            auto m = check(conf, parts);
-            if (m) return m;
-        }
+std::unique_ptr<fostgres::pooled_connection>
+        fostgres::match::take_lease(const fostlib::pg::connection &cnx) const {
+    if (lease_for(cnx)) {
+        auto taken = std::make_unique<pooled_connection>(std::move(**lease));
+        lease->reset();
+        return taken;
+    } else {
+        return nullptr;
     }
-    return fostlib::null;
 }
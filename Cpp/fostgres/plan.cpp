@@ -0,0 +1,586 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fostgres/plan.hpp>
+#include "shards.hpp"
+
+#include <fost/string>
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+
+namespace {
+    /// Settings that are either a row count or `true` for a default count
+    std::size_t row_count(const fostlib::json &setting, std::size_t dflt) {
+        if (setting == fostlib::json{true}) {
+            return dflt;
+        } else if (auto rows =
+                           fostlib::coerce<fostlib::nullable<int64_t>>(setting);
+                   rows && *rows > 0) {
+            return *rows;
+        } else {
+            return 0;
+        }
+    }
+
+    /// True for the responders that only read on a `GET`
+    bool reads_only(const std::optional<fostlib::string> &returns) {
+        if (not returns) { return true; }
+        for (auto const name :
+             {"csj", "object", "json-csv", "ndjson", "json-array",
+              "json-raw"}) {
+            if (f5::u8view{*returns} == name) { return true; }
+        }
+        return false;
+    }
+
+    /// True if the predicate calls the function anywhere in it
+    bool calls(
+            const fostlib::json &predicate, const fostlib::json &function) {
+        if (not predicate.isarray()) { return false; }
+        bool first = true;
+        for (auto const &part : predicate) {
+            if (first && part == function) { return true; }
+            first = false;
+            if (calls(part, function)) { return true; }
+        }
+        return false;
+    }
+
+    /// The SQL without any trailing `;`, white space or comments, so that
+    /// it can be embedded in a larger statement. Throws if it is more than
+    /// one statement.
+    /// Checks that the SQL is a single statement and returns it without a
+    /// trailing `;` or comments. `returning` is set if the statement has
+    /// its own `RETURNING` clause (outside of any brackets)
+    fostlib::string single_statement(
+            f5::u8view const sql,
+            const fostlib::json &configuration,
+            bool &returning) {
+        std::string_view const text{sql.data(), sql.bytes()};
+        auto const ident = [](char const c) {
+            return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                    || (c >= '0' && c <= '9');
+        };
+        auto const is_returning = [](std::string_view word) {
+            std::string_view const keyword{"returning"};
+            return word.size() == keyword.size()
+                    && std::equal(
+                            word.begin(), word.end(), keyword.begin(),
+                            [](char const w, char const k) {
+                                return (w | 0x20) == k;
+                            });
+        };
+        /// The end of the last part of the statement that matters
+        std::size_t end{};
+        std::size_t depth{};
+        bool terminated = false;
+        returning = false;
+        for (std::size_t pos{}; pos < text.size();) {
+            char const c = text[pos];
+            std::size_t next = pos + 1;
+            if (c == '-' && text.substr(pos, 2) == "--") {
+                next = std::min(text.find('\n', pos), text.size());
+            } else if (c == '/' && text.substr(pos, 2) == "/*") {
+                next = std::min(text.find("*/", pos + 2), text.size() - 2) + 2;
+            } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                /// White space doesn't matter
+            } else if (c == ';') {
+                terminated = true;
+            } else {
+                if (terminated) {
+                    throw fostlib::exceptions::not_implemented(
+                            __func__,
+                            "The SQL must be a single statement", configuration);
+                }
+                if (c == '\'' || c == '"') {
+                    /// Doubled quotes are found as two quoted strings
+                    next = std::min(text.find(c, pos + 1), text.size() - 1) + 1;
+                } else if (
+                        c == '$' && pos + 1 < text.size()
+                        && not(text[pos + 1] >= '0' && text[pos + 1] <= '9')) {
+                    auto const close = text.find('$', pos + 1);
+                    auto const tag = text.substr(pos, close - pos + 1);
+                    if (close != std::string_view::npos
+                        && std::all_of(tag.begin() + 1, tag.end() - 1, ident)) {
+                        next = std::min(
+                                       text.find(tag, close + 1),
+                                       text.size() - tag.size())
+                                + tag.size();
+                    }
+                } else if (c == '(') {
+                    ++depth;
+                } else if (c == ')') {
+                    if (depth) { --depth; }
+                } else if (ident(c) && not(c >= '0' && c <= '9')) {
+                    while (next < text.size() && ident(text[next])) { ++next; }
+                    if (not depth
+                        && is_returning(text.substr(pos, next - pos))) {
+                        returning = true;
+                    }
+                }
+                end = next;
+            }
+            pos = next;
+        }
+        if (not end) {
+            throw fostlib::exceptions::not_implemented(
+                    __func__, "The SQL is empty", configuration);
+        }
+        return fostlib::string{text.substr(0, end)};
+    }
+
+
+    std::shared_ptr<const f5::json::schema>
+            compile_schema(const fostlib::json &configuration) {
+        if (configuration.has_key("schema")) {
+            return std::make_shared<const f5::json::schema>(
+                    fostlib::url{}, configuration["schema"]);
+        } else {
+            return nullptr;
+        }
+    }
+}
+
+
+/**
+ * ## `fostgres::select_plan`
+ */
+
+
+fostgres::select_plan::select_plan(fostlib::json c)
+: configuration(std::move(c)) {
+    if (configuration.isobject()) {
+        /// Badly formed configurations are left uncompiled so that the
+        /// error is reported when the end point is used
+        if (not configuration["arguments"].isnull()
+            && not configuration["command"].isnull()) {
+            command = fostlib::coerce<fostlib::string>(configuration["command"]);
+            arguments.emplace();
+            for (const auto &arg : configuration["arguments"]) {
+                arguments->push_back(arg);
+            }
+        }
+    } else if (auto sql = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                       configuration);
+               sql) {
+        command = fostlib::string{*sql};
+    }
+}
+
+
+/**
+ * ## `fostgres::column_definition`
+ */
+
+
+fostgres::column_definition::column_definition(
+        fostlib::string n, fostlib::json c)
+: name(std::move(n)),
+  configuration(std::move(c)),
+  key(configuration["key"].get(false)),
+  insert_required(configuration["insert"] == "required"),
+  source(name, configuration),
+  schema(compile_schema(configuration)) {}
+
+
+/**
+ * ## `fostgres::method_plan`
+ */
+
+
+fostgres::method_plan::method_plan(fostlib::json c)
+: configuration(std::move(c)), schema(compile_schema(configuration)) {
+    if (auto t = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                configuration["table"]);
+        t) {
+        table = fostlib::string{*t};
+    }
+    if (configuration["columns"].isobject()) {
+        for (const auto &col : configuration["columns"].object()) {
+            columns.emplace_back(col.first, col.second);
+            pure_columns = pure_columns && columns.back().source.pure();
+        }
+    }
+    for (const auto &r : configuration["returning"]) {
+        if (auto s = fostlib::coerce<fostlib::nullable<f5::u8view>>(r); s) {
+            returning.emplace_back(*s);
+        }
+    }
+    if (auto e = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                configuration["existing"]);
+        e) {
+        existing = fostlib::string{*e};
+    }
+    if (auto d = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                configuration["delete"]);
+        d) {
+        delete_sql = fostlib::string{*d};
+    }
+    if (auto d = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                configuration["delete-unseen"]);
+        d) {
+        delete_unseen =
+                single_statement(*d, configuration, delete_unseen_returns);
+    }
+    if (configuration.has_key("array")) {
+        array = fostlib::coerce<fostlib::jcursor>(configuration["array"]);
+    }
+    batch = row_count(configuration["batch"], 1000);
+    bulk = row_count(configuration["bulk"], 1000);
+    parallel = row_count(
+            configuration["parallel"], std::thread::hardware_concurrency());
+}
+
+
+/**
+ * ## `fostgres::endpoint`
+ */
+
+
+namespace {
+    std::vector<std::shared_ptr<const fostgres::method_plan>>
+            compile_methods(const fostlib::json &config) {
+        std::vector<std::shared_ptr<const fostgres::method_plan>> methods;
+        if (config.isobject()) {
+            methods.push_back(
+                    std::make_shared<const fostgres::method_plan>(config));
+        } else if (config.isarray()) {
+            for (const auto &c : config) {
+                methods.push_back(
+                        std::make_shared<const fostgres::method_plan>(c));
+            }
+        }
+        return methods;
+    }
+}
+
+
+fostgres::endpoint::endpoint(fostlib::json c) : configuration(std::move(c)) {
+    if (configuration.has_key("path")) {
+        path.emplace();
+        for (const auto &element : configuration["path"]) {
+            path_segment segment;
+            auto const s = fostlib::coerce<fostlib::string>(element);
+            if (s.starts_with("/")) {
+                segment.literal =
+                        fostlib::string{static_cast<f5::u8view>(s).substr(1)};
+            } else {
+                try {
+                    segment.argument = fostlib::coerce<unsigned int>(element);
+                } catch (fostlib::exceptions::exception &) {}
+                segment.invalid = (segment.argument == 0);
+            }
+            path->push_back(std::move(segment));
+        }
+    }
+
+    if (auto r = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                configuration["return"]);
+        r) {
+        returns = fostlib::string{*r};
+        responder = responder::find(*r);
+    }
+
+    if (configuration.has_key("precondition")) {
+        has_precondition = true;
+        auto const &pc = configuration["precondition"];
+        if (pc.isobject()) {
+            precondition = pc["check"];
+            if (pc.has_key("failed")) { precondition_failed = pc["failed"]; }
+        } else {
+            precondition = pc;
+        }
+    }
+
+    if (configuration.has_key("GET")) {
+        get = select_plan{configuration["GET"]};
+    }
+    if (auto const s = configuration["shard"].get<int64_t>(); s && *s > 0) {
+        shard = *s;
+    }
+    stream = row_count(configuration["stream"], 1000);
+    if (configuration["read-only"] == fostlib::json{"deferrable"}) {
+        read_only = deferrable = true;
+    } else {
+        read_only = configuration["read-only"].get(false);
+    }
+    replica = configuration["replica"].get(true) && reads_only(returns)
+            && not calls(precondition, fostlib::json{"sql.exists"});
+    put = compile_methods(configuration["PUT"]);
+    patch = compile_methods(configuration["PATCH"]);
+    post = compile_methods(configuration["POST"]);
+    if (auto d = fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                configuration["DELETE"]);
+        d) {
+        del = fostlib::string{*d};
+    }
+}
+
+
+const std::vector<std::shared_ptr<const fostgres::method_plan>> &
+        fostgres::endpoint::methods(f5::u8view method) const {
+    static const std::vector<std::shared_ptr<const method_plan>> none;
+    if (method == "PUT") {
+        return put;
+    } else if (method == "PATCH") {
+        return patch;
+    } else if (method == "POST") {
+        return post;
+    } else {
+        return none;
+    }
+}
+
+
+const std::shared_ptr<const fostgres::method_plan> &
+        fostgres::endpoint::method(f5::u8view name) const {
+    auto const &plans = methods(name);
+    if (plans.empty()) {
+        throw fostlib::exceptions::not_implemented(
+                __PRETTY_FUNCTION__,
+                "There is no configuration for this method",
+                fostlib::string{name});
+    }
+    return plans.front();
+}
+
+
+const fostgres::endpoint &fostgres::match::plan() const {
+    if (not compiled) {
+        compiled = std::make_shared<const endpoint>(configuration);
+    }
+    return *compiled;
+}
+
+
+/**
+ * ## `fostgres::view_plan`
+ */
+
+
+namespace {
+    constexpr std::size_t c_no_endpoint =
+            std::numeric_limits<std::size_t>::max();
+
+    /// Split the next segment off the path. Empty segments are skipped in
+    /// the same way as `fostlib::split` does
+    std::string_view next_segment(std::string_view &path) {
+        while (path.size() && path.front() == '/') { path.remove_prefix(1); }
+        auto const slash = path.find('/');
+        auto const segment = path.substr(0, slash);
+        path.remove_prefix(segment.size());
+        return segment;
+    }
+
+    std::string_view as_view(const fostlib::string &s) {
+        f5::u8view const v{s};
+        return {v.data(), v.bytes()};
+    }
+}
+
+
+fostgres::view_plan::view_plan(const fostlib::json &sql)
+: nodes(1, trie_node{{}, 0, c_no_endpoint, c_no_endpoint}) {
+    if (sql.isobject()) {
+        endpoints.push_back(std::make_shared<const endpoint>(sql));
+    } else if (sql.isarray()) {
+        for (const auto &ep : sql) {
+            endpoints.push_back(std::make_shared<const endpoint>(ep));
+        }
+    }
+    for (std::size_t index{}; index < endpoints.size(); ++index) {
+        add(index);
+    }
+}
+
+
+void fostgres::view_plan::add(std::size_t const index) {
+    auto const &ep = *endpoints[index];
+    if (not ep.path) { return; }
+    std::size_t current{};
+    nodes[current].lowest = std::min(nodes[current].lowest, index);
+    for (auto const &segment : *ep.path) {
+        std::size_t next{};
+        if (segment.argument || segment.invalid) {
+            next = nodes[current].capture;
+        } else {
+            auto const text = as_view(segment.literal);
+            if (auto found = nodes[current].literals.find(text);
+                found != nodes[current].literals.end()) {
+                next = found->second;
+            }
+        }
+        if (not next) {
+            /// `nodes` may reallocate, so no references are held over this
+            next = nodes.size();
+            nodes.push_back(trie_node{{}, 0, c_no_endpoint, c_no_endpoint});
+            if (segment.argument || segment.invalid) {
+                nodes[current].capture = next;
+            } else {
+                nodes[current].literals.emplace(
+                        as_view(segment.literal), next);
+            }
+        }
+        current = next;
+        nodes[current].lowest = std::min(nodes[current].lowest, index);
+    }
+    nodes[current].endpoint = std::min(nodes[current].endpoint, index);
+}
+
+
+std::size_t fostgres::view_plan::search(
+        std::size_t const index, std::string_view path, std::size_t best) const {
+    auto const &node = nodes[index];
+    if (node.lowest >= best) { return best; }
+    auto const segment = next_segment(path);
+    if (segment.empty()) { return std::min(best, node.endpoint); }
+    if (auto found = node.literals.find(segment);
+        found != node.literals.end()) {
+        best = search(found->second, path, best);
+    }
+    if (node.capture) { best = search(node.capture, path, best); }
+    return best;
+}
+
+
+fostlib::nullable<fostgres::match>
+        fostgres::view_plan::matcher(f5::u8view path) const {
+    std::string_view const url{path.data(), path.bytes()};
+    auto const found = search(0, url, c_no_endpoint);
+    if (found == c_no_endpoint) { return fostlib::null; }
+
+    auto const &ep = endpoints[found];
+    fostgres::match m{ep->configuration, {}, ep};
+    std::string_view remaining{url};
+    for (auto const &segment : *ep->path) {
+        auto const part = next_segment(remaining);
+        if (segment.invalid) {
+            throw fostlib::exceptions::not_implemented(
+                    __FUNCTION__, "Path arguments numbers cannot be zero");
+        } else if (segment.argument) {
+            if (segment.argument > m.arguments.size()) {
+                m.arguments.resize(segment.argument);
+            }
+            m.arguments[segment.argument - 1] =
+                    fostlib::coerce<fostlib::string>(
+                            fostlib::url::filepath_string(
+                                    fostlib::string{std::string{part}}));
+        }
+    }
+    return m;
+}
+
+
+namespace {
+    /// Compiled plans are kept for this many view configurations. When
+    /// there are more the oldest is dropped
+    constexpr std::size_t c_max_plans = 256;
+
+    struct cached_plan {
+        /// Kept so that the address used as the key can't be re-used for
+        /// something else while the plan is in the cache
+        fostlib::json configuration;
+        std::string text;
+        std::shared_ptr<const fostgres::view_plan> plan;
+    };
+    struct plan_cache {
+        std::shared_mutex mutex;
+        /// Looked up by the identity of the configuration's storage, which
+        /// is cheap. JSON objects share their storage when copied, so this
+        /// finds the plan for the same view on every request.
+        std::map<const void *, cached_plan> by_identity;
+        /// The identities, oldest first
+        std::deque<const void *> order;
+        /// A configuration that has been built again (for example when the
+        /// server configuration is reloaded) shares the plan for the same
+        /// text rather than being compiled again
+        std::map<std::string, std::weak_ptr<const fostgres::view_plan>>
+                by_text;
+
+        /// Drop the oldest plan. Called with the mutex held exclusively
+        void evict() {
+            auto oldest = by_identity.find(order.front());
+            order.pop_front();
+            std::string const text{std::move(oldest->second.text)};
+            by_identity.erase(oldest);
+            if (auto found = by_text.find(text);
+                found != by_text.end() && found->second.expired()) {
+                by_text.erase(found);
+            }
+        }
+        /// Plans still in use by a request when they were evicted leave
+        /// their text behind. Those are cleared out once in a while
+        void sweep() {
+            if (by_text.size() < 2 * c_max_plans) { return; }
+            for (auto pos = by_text.begin(); pos != by_text.end();) {
+                if (pos->second.expired()) {
+                    pos = by_text.erase(pos);
+                } else {
+                    ++pos;
+                }
+            }
+        }
+    };
+    plan_cache &g_plans() {
+        static plan_cache cache;
+        return cache;
+    }
+}
+
+
+std::shared_ptr<const fostgres::view_plan>
+        fostgres::view_plan::compiled(const fostlib::json &config) {
+    if (not config.isobject()) {
+        return std::make_shared<const view_plan>(fostlib::json{});
+    }
+    auto &cache = g_plans();
+    const void *const identity = &config.object();
+    {
+        std::shared_lock<std::shared_mutex> lock{cache.mutex};
+        if (auto found = cache.by_identity.find(identity);
+            found != cache.by_identity.end()) {
+            return found->second.plan;
+        }
+    }
+    std::string text{as_view(fostlib::json::unparse(config, false))};
+    std::shared_ptr<const view_plan> plan;
+    {
+        std::shared_lock<std::shared_mutex> lock{cache.mutex};
+        if (auto found = cache.by_text.find(text);
+            found != cache.by_text.end()) {
+            plan = found->second.lock();
+        }
+    }
+    if (not plan) {
+        auto compiling = std::make_shared<view_plan>(config["sql"]);
+        if (config.has_key("shards")) {
+            compiling->shards =
+                    std::make_shared<const shard_map>(config["shards"]);
+        }
+        plan = std::move(compiling);
+    }
+    std::unique_lock<std::shared_mutex> lock{cache.mutex};
+    if (auto found = cache.by_identity.find(identity);
+        found != cache.by_identity.end()) {
+        /// Another thread got here first
+        return found->second.plan;
+    }
+    while (cache.by_identity.size() >= c_max_plans) { cache.evict(); }
+    cache.sweep();
+    cache.by_text[text] = plan;
+    cache.order.push_back(identity);
+    cache.by_identity.emplace(
+            identity, cached_plan{config, std::move(text), plan});
+    return plan;
+}
@@ -0,0 +1,245 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fostgres/plan.hpp>
+#include <fost/insert>
+#include <fost/push_back>
+#include <fost/test>
+
+
+FSL_TEST_SUITE(plan);
+
+
+FSL_TEST_FUNCTION(empty) {
+    fostgres::view_plan const plan{fostlib::json{}};
+    FSL_CHECK(not plan.matcher(""));
+}
+
+
+FSL_TEST_FUNCTION(first_match_wins) {
+    fostlib::json first, second, config;
+    fostlib::push_back(first, "path", "/foo");
+    fostlib::push_back(first, "path", 1);
+    fostlib::insert(first, "GET", "SELECT 1");
+    fostlib::push_back(second, "path", 1);
+    fostlib::push_back(second, "path", 2);
+    fostlib::insert(second, "GET", "SELECT 2");
+    fostlib::push_back(config, "sql", first);
+    fostlib::push_back(config, "sql", second);
+
+    fostgres::view_plan const plan{config["sql"]};
+    auto m1 = plan.matcher("foo/bar/");
+    FSL_CHECK(m1);
+    FSL_CHECK_EQ(m1->plan().get.command, "SELECT 1");
+    FSL_CHECK_EQ(m1->arguments.size(), 1u);
+    FSL_CHECK_EQ(m1->arguments[0], "bar");
+
+    auto m2 = plan.matcher("baz/bar/");
+    FSL_CHECK(m2);
+    FSL_CHECK_EQ(m2->plan().get.command, "SELECT 2");
+    FSL_CHECK_EQ(m2->arguments.size(), 2u);
+}
+
+
+FSL_TEST_FUNCTION(compiled_once) {
+    fostlib::json config;
+    fostlib::push_back(config, "sql", "path", 1);
+    auto const p1 = fostgres::view_plan::compiled(config);
+    auto const p2 = fostgres::view_plan::compiled(config);
+    FSL_CHECK(p1 == p2);
+}
+
+
+FSL_TEST_FUNCTION(compiled_same_text) {
+    fostlib::json c1, c2;
+    fostlib::push_back(c1, "sql", "path", "same-text");
+    fostlib::push_back(c2, "sql", "path", "same-text");
+    auto const p1 = fostgres::view_plan::compiled(c1);
+    auto const p2 = fostgres::view_plan::compiled(c2);
+    FSL_CHECK(p1 == p2);
+}
+
+
+FSL_TEST_FUNCTION(compiled_evicts_oldest) {
+    fostlib::json first;
+    fostlib::push_back(first, "sql", "path", "first");
+    auto const p1 = fostgres::view_plan::compiled(first);
+    /// Fill the cache so the first plan is the one that is dropped, while
+    /// keeping the configurations alive so none of their addresses match
+    std::vector<fostlib::json> others;
+    for (std::size_t index{}; index < 300u; ++index) {
+        fostlib::json config;
+        fostlib::push_back(
+                config, "sql", "path",
+                fostlib::string{"other-" + std::to_string(index)});
+        fostgres::view_plan::compiled(config);
+        others.push_back(std::move(config));
+    }
+    /// The first plan is still in use, so the same text gets it back
+    auto const p2 = fostgres::view_plan::compiled(first);
+    FSL_CHECK(p1 == p2);
+    auto const recent = fostgres::view_plan::compiled(others.back());
+    FSL_CHECK(recent == fostgres::view_plan::compiled(others.back()));
+}
+
+
+FSL_TEST_FUNCTION(method_columns) {
+    fostlib::json config;
+    fostlib::insert(config, "table", "films");
+    fostlib::insert(config, "columns", "slug", "key", true);
+    fostlib::insert(config, "columns", "title", "insert", "required");
+    fostlib::push_back(config, "returning", "slug");
+
+    fostgres::method_plan const plan{config};
+    FSL_CHECK_EQ(plan.table, "films");
+    FSL_CHECK_EQ(plan.columns.size(), 2u);
+    FSL_CHECK_EQ(plan.returning.size(), 1u);
+    for (auto const &column : plan.columns) {
+        FSL_CHECK_EQ(column.key, column.name == "slug");
+        FSL_CHECK_EQ(column.insert_required, column.name == "title");
+    }
+}
+
+
+FSL_TEST_FUNCTION(schemas_are_compiled) {
+    fostlib::json config;
+    fostlib::insert(config, "table", "films");
+    fostlib::insert(config, "schema", "type", "object");
+    fostlib::insert(config, "columns", "slug", "key", true);
+    fostlib::insert(
+            config, "columns", "title", "schema", "type", "string");
+
+    fostgres::method_plan const plan{config};
+    FSL_CHECK(plan.schema);
+    FSL_CHECK(plan.schema->validate(
+            fostlib::json{fostlib::json::object_t{}}));
+    FSL_CHECK(not plan.schema->validate(fostlib::json{1}));
+    for (auto const &column : plan.columns) {
+        FSL_CHECK_EQ(bool(column.schema), column.name == "title");
+    }
+}
+
+
+FSL_TEST_FUNCTION(delete_unseen_is_one_statement) {
+    auto const compile = [](f5::u8view sql) {
+        fostlib::json config;
+        fostlib::insert(config, "table", "films");
+        fostlib::insert(config, "delete-unseen", sql);
+        return fostgres::method_plan{config}.delete_unseen.value();
+    };
+    FSL_CHECK_EQ(compile("DELETE FROM films"), "DELETE FROM films");
+    FSL_CHECK_EQ(compile("DELETE FROM films;\n"), "DELETE FROM films");
+    FSL_CHECK_EQ(
+            compile("DELETE FROM films -- all of them\n;"),
+            "DELETE FROM films");
+    FSL_CHECK_EQ(
+            compile("DELETE FROM films WHERE slug='a;b' /* c */ ; -- d"),
+            "DELETE FROM films WHERE slug='a;b'");
+    FSL_CHECK_EQ(
+            compile("DELETE FROM films WHERE slug=$x$;--$x$ AND $1 IS NULL;"),
+            "DELETE FROM films WHERE slug=$x$;--$x$ AND $1 IS NULL");
+    FSL_CHECK_EXCEPTION(
+            compile("DELETE FROM films; DELETE FROM film_tags"),
+            fostlib::exceptions::not_implemented &);
+    FSL_CHECK_EXCEPTION(
+            compile(" ; -- nothing"), fostlib::exceptions::not_implemented &);
+}
+
+
+FSL_TEST_FUNCTION(delete_unseen_returning) {
+    auto const returns = [](f5::u8view sql) {
+        fostlib::json config;
+        fostlib::insert(config, "table", "films");
+        fostlib::insert(config, "delete-unseen", sql);
+        return fostgres::method_plan{config}.delete_unseen_returns;
+    };
+    FSL_CHECK(not returns("DELETE FROM films"));
+    FSL_CHECK(returns("DELETE FROM films RETURNING slug;"));
+    FSL_CHECK(returns("DELETE FROM films\nreturning *"));
+    FSL_CHECK(not returns("DELETE FROM films WHERE slug='returning'"));
+    FSL_CHECK(not returns("DELETE FROM films WHERE returning_x=1"));
+    FSL_CHECK(not returns("DELETE FROM films -- RETURNING slug"));
+    FSL_CHECK(
+            not returns("WITH d AS (DELETE FROM films RETURNING slug) "
+                        "DELETE FROM film_tags WHERE film_slug IN "
+                        "(SELECT slug FROM d)"));
+}
+
+
+FSL_TEST_FUNCTION(batch_and_bulk) {
+    fostlib::json config;
+    fostlib::insert(config, "table", "films");
+    FSL_CHECK_EQ(fostgres::method_plan{config}.batch, 0u);
+    FSL_CHECK_EQ(fostgres::method_plan{config}.bulk, 0u);
+
+    fostlib::insert(config, "batch", 500);
+    fostlib::insert(config, "bulk", true);
+    fostgres::method_plan const plan{config};
+    FSL_CHECK_EQ(plan.batch, 500u);
+    FSL_CHECK_EQ(plan.bulk, 1000u);
+}
+
+
+FSL_TEST_FUNCTION(literal_and_capture_share_prefix) {
+    fostlib::json first, second, config;
+    fostlib::push_back(first, "path", 1);
+    fostlib::push_back(first, "path", "/edit");
+    fostlib::push_back(second, "path", "/films");
+    fostlib::push_back(second, "path", 1);
+    fostlib::push_back(config, first);
+    fostlib::push_back(config, second);
+
+    fostgres::view_plan const plan{config};
+    auto m1 = plan.matcher("films/edit");
+    FSL_CHECK(m1);
+    FSL_CHECK(m1->configuration == first);
+    FSL_CHECK_EQ(m1->arguments[0], "films");
+    auto m2 = plan.matcher("films/alien");
+    FSL_CHECK(m2);
+    FSL_CHECK(m2->configuration == second);
+    FSL_CHECK_EQ(m2->arguments[0], "alien");
+    FSL_CHECK(not plan.matcher("films"));
+    FSL_CHECK(not plan.matcher("films/alien/edit"));
+}
+
+
+FSL_TEST_FUNCTION(read_only) {
+    fostlib::json plain, ro, deferrable;
+    fostlib::insert(ro, "read-only", true);
+    fostlib::insert(deferrable, "read-only", "deferrable");
+
+    fostgres::endpoint const e1{plain};
+    FSL_CHECK(not e1.read_only);
+    fostgres::endpoint const e2{ro};
+    FSL_CHECK(e2.read_only);
+    FSL_CHECK(not e2.deferrable);
+    fostgres::endpoint const e3{deferrable};
+    FSL_CHECK(e3.read_only);
+    FSL_CHECK(e3.deferrable);
+}
+
+
+FSL_TEST_FUNCTION(replica) {
+    fostlib::json plain, deferrable, off, custom, exists;
+    fostlib::insert(plain, "GET", "SELECT 1");
+    fostlib::insert(deferrable, "read-only", "deferrable");
+    fostlib::insert(off, "replica", false);
+    fostlib::insert(custom, "return", "custom-responder");
+    fostlib::push_back(exists, "precondition", "and");
+    fostlib::push_back(exists, "precondition", true);
+    fostlib::json check;
+    fostlib::push_back(check, "sql.exists");
+    fostlib::push_back(check, "SELECT 1");
+    fostlib::push_back(exists, "precondition", check);
+
+    FSL_CHECK(fostgres::endpoint{plain}.replica);
+    FSL_CHECK(fostgres::endpoint{deferrable}.replica);
+    FSL_CHECK(not fostgres::endpoint{off}.replica);
+    FSL_CHECK(not fostgres::endpoint{custom}.replica);
+    FSL_CHECK(not fostgres::endpoint{exists}.replica);
+}
@@ -0,0 +1,352 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fostgres/callback.hpp>
+#include <fostgres/db.hpp>
+#include <fostgres/fostgres.hpp>
+#include <fostgres/pool.hpp>
+#include <fostgres/sql.hpp>
+#include <fostgres/statements.hpp>
+
+#include <fost/insert>
+#include <fost/log>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+
+namespace {
+
+
+    const fostlib::module c_pool{fostgres::c_fostgres, "pool"};
+
+
+    using clock_type = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+
+    /// Only the atoms in the connection configuration describe the
+    /// database we connect to. Everything else (the `sql` end points,
+    /// the `pool` settings etc.) is view configuration.
+    fostlib::json dsn_of(const fostlib::json &config) {
+        fostlib::json dsn{fostlib::json::object_t()};
+        for (const auto &item : config.object()) {
+            if (item.second.isatom()) {
+                fostlib::insert(dsn, item.first, item.second);
+            }
+        }
+        return dsn;
+    }
+
+
+    /// Set up a connection that is about to serve the request
+    void set_up(
+            fostlib::pg::connection &cnx,
+            const fostlib::http::server::request &req) {
+        static const fostlib::jcursor ziloc("headers", "__pgzoneinfo");
+        const auto zoneinfo =
+                fostlib::coerce<fostlib::nullable<fostlib::string>>(
+                        req[ziloc]);
+        if (zoneinfo) { cnx.zoneinfo(zoneinfo.value()); }
+        fostgres::connection_established(cnx, req);
+    }
+
+
+    template<typename T>
+    T pool_setting(const fostlib::json &config, f5::u8view name, T dflt) {
+        if (config.isobject() && config.has_key(name)) {
+            return fostlib::coerce<T>(config[name]);
+        } else {
+            return dflt;
+        }
+    }
+
+
+}
+
+
+/**
+ * ## `fostgres::pool_exhausted`
+ */
+
+
+fostgres::pool_exhausted::pool_exhausted(
+        const fostlib::json &dsn, std::size_t const max) {
+    fostlib::insert(data(), "dsn", dsn);
+    fostlib::insert(data(), "pool", "max", max);
+}
+
+
+const wchar_t *const fostgres::pool_exhausted::message() const noexcept {
+    return L"Timed out waiting for a pooled database connection";
+}
+
+
+/**
+ * ## `fostgres::pooled_connection::pool`
+ */
+
+
+struct fostgres::pooled_connection::pool {
+    const fostlib::json dsn;
+    /// Number of idle connections kept open regardless of how long they
+    /// have been idle for
+    const std::size_t min;
+    /// Maximum number of connections open at any one time, including those
+    /// currently lent out to requests
+    const std::size_t max;
+    /// How long a connection can be idle before it is closed
+    const seconds idle;
+    /// Connections idle for longer than this are checked before being
+    /// handed out
+    const seconds check;
+    /// How long to wait for a connection when the pool is exhausted
+    const seconds wait;
+    /// The size of the prepared statement cache for each connection. Zero
+    /// turns the cache off.
+    const std::size_t statements;
+    /// Shared by the statement caches of the pool's connections
+    const statement_cache::generation_type generation =
+            std::make_shared<std::atomic<std::size_t>>();
+
+    pool(fostlib::json d, const fostlib::json &config)
+    : dsn(std::move(d)),
+      min(pool_setting<int64_t>(config, "min", 0)),
+      max(pool_setting<int64_t>(config, "max", 20)),
+      idle(pool_setting<double>(config, "idle", 300)),
+      check(pool_setting<double>(config, "check", 5)),
+      wait(pool_setting<double>(config, "wait", 10)),
+      statements(pool_setting<int64_t>(config, "statements", 100)) {}
+
+    struct pooled {
+        std::unique_ptr<fostlib::pg::connection> cnx;
+        std::shared_ptr<statement_cache> statements;
+    };
+
+    pooled checkout() {
+        auto const deadline = clock_type::now()
+                + std::chrono::duration_cast<clock_type::duration>(wait);
+        std::unique_lock<std::mutex> lock{mutex};
+        while (true) {
+            evict(lock);
+            if (idle_connections.size()) {
+                auto ic = std::move(idle_connections.back());
+                idle_connections.pop_back();
+                if (clock_type::now() - ic.since <= check) {
+                    return std::move(ic.connection);
+                }
+                /// Make sure the backend is still there before we use it
+                lock.unlock();
+                try {
+                    ic.connection.cnx->exec("SELECT 1");
+                    return std::move(ic.connection);
+                } catch (std::exception &e) {
+                    fostlib::log::warning(c_pool)(
+                            "", "Dropping broken pooled connection")(
+                            "dsn", dsn)("exception", e.what());
+                    ic.connection = {};
+                    lock.lock();
+                    --open;
+                }
+            } else if (open < max) {
+                ++open;
+                lock.unlock();
+                try {
+                    pooled p{std::make_unique<fostlib::pg::connection>(
+                            fostgres::connection(dsn, fostlib::null))};
+                    if (statements) {
+                        p.statements = std::make_shared<statement_cache>(
+                                statements, generation);
+                    }
+                    fostlib::log::debug(c_pool)(
+                            "", "New pooled connection")("dsn", dsn)(
+                            "max", max);
+                    return p;
+                } catch (...) {
+                    lock.lock();
+                    --open;
+                    returned.notify_one();
+                    throw;
+                }
+            } else if (
+                    returned.wait_until(lock, deadline)
+                            == std::cv_status::timeout
+                    && idle_connections.empty() && open >= max) {
+                throw fostgres::pool_exhausted{dsn, max};
+            }
+        }
+    }
+
+    void checkin(pooled p) {
+        std::unique_lock<std::mutex> lock{mutex};
+        idle_connections.push_back({std::move(p), clock_type::now()});
+        returned.notify_one();
+    }
+
+    std::size_t lent() {
+        std::unique_lock<std::mutex> lock{mutex};
+        return open - idle_connections.size();
+    }
+
+    void discard() {
+        std::unique_lock<std::mutex> lock{mutex};
+        --open;
+        returned.notify_one();
+    }
+
+  private:
+    struct idle_connection {
+        pooled connection;
+        clock_type::time_point since;
+    };
+
+    std::mutex mutex;
+    std::condition_variable returned;
+    std::size_t open = 0;
+    /// Ordered oldest first. Connections are lent out from the back so the
+    /// warmest ones get re-used and the cold ones age out at the front.
+    std::vector<idle_connection> idle_connections;
+
+    void evict(std::unique_lock<std::mutex> &lock) {
+        const auto now = clock_type::now();
+        std::vector<idle_connection> expired;
+        while (open > min && idle_connections.size()
+               && now - idle_connections.front().since > idle) {
+            expired.push_back(std::move(idle_connections.front()));
+            idle_connections.erase(idle_connections.begin());
+            --open;
+        }
+        if (expired.size()) {
+            /// Close the connections without holding the pool lock
+            lock.unlock();
+            expired.clear();
+            lock.lock();
+        }
+    }
+};
+
+
+namespace {
+    std::mutex g_pools_mut;
+    auto &g_pools() {
+        static std::map<
+                fostlib::string,
+                std::shared_ptr<fostgres::pooled_connection::pool>>
+                pools;
+        return pools;
+    }
+
+    std::shared_ptr<fostgres::pooled_connection::pool>
+            pool_for(const fostlib::json &config) {
+        auto dsn = dsn_of(config);
+        auto key = fostlib::json::unparse(dsn, false);
+        std::unique_lock<std::mutex> lock{g_pools_mut};
+        auto &p = g_pools()[key];
+        if (not p) {
+            p = std::make_shared<fostgres::pooled_connection::pool>(
+                    std::move(dsn), config["pool"]);
+        }
+        return p;
+    }
+
+
+}
+
+
+/**
+ * ## `fostgres::pooled_connection`
+ */
+
+
+fostgres::pooled_connection::pooled_connection(
+        fostlib::json config, const fostlib::http::server::request &req) {
+    config = connection_config(config, req);
+    static const fostlib::jcursor ziloc("headers", "__pgzoneinfo");
+    const auto zoneinfo =
+            fostlib::coerce<fostlib::nullable<fostlib::string>>(req[ziloc]);
+    if (config.has_key("pool")) {
+        owner = pool_for(config);
+        auto p = owner->checkout();
+        cnx = std::move(p.cnx);
+        statements = std::move(p.statements);
+        try {
+            set_up(*cnx, req);
+        } catch (...) {
+            cnx.reset();
+            owner->discard();
+            throw;
+        }
+    } else {
+        cnx = std::make_unique<fostlib::pg::connection>(
+                fostgres::connection(config, zoneinfo, req));
+    }
+}
+
+
+fostgres::pooled_connection::pooled_connection(pooled_connection &&l)
+: owner(std::move(l.owner)),
+  cnx(std::move(l.cnx)),
+  statements(std::move(l.statements)) {}
+
+
+fostgres::pooled_connection::~pooled_connection() {
+    if (owner && cnx) {
+        /// The lease wasn't released so we can't trust the state of the
+        /// transaction. Closing the connection will roll it back.
+        cnx.reset();
+        owner->discard();
+    }
+}
+
+
+void fostgres::pooled_connection::release() { finish(false); }
+void fostgres::pooled_connection::commit() { finish(true); }
+
+
+void fostgres::pooled_connection::restart(
+        f5::u8view const begin, const fostlib::http::server::request &req) {
+    std::string sql{"ROLLBACK; "};
+    sql.append(begin.data(), begin.bytes());
+    cnx->exec(fostlib::utf8_string{sql});
+    set_up(*cnx, req);
+}
+
+
+void fostgres::pooled_connection::finish(bool const commit) {
+    if (owner && cnx) {
+        try {
+            if (commit) {
+                cnx->exec("RESET ALL");
+            } else {
+                /// The empty transaction is there for `commit` to finish
+                cnx->exec("ROLLBACK; RESET ALL; BEGIN");
+            }
+            cnx->commit();
+            owner->checkin({std::move(cnx), std::move(statements)});
+        } catch (std::exception &e) {
+            fostlib::log::warning(c_pool)(
+                    "", "Could not reset pooled connection")(
+                    "dsn", owner->dsn)("exception", e.what());
+            cnx.reset();
+            owner->discard();
+        }
+        owner.reset();
+    }
+}
+
+
+std::size_t fostgres::pooled_connection::in_use(
+        fostlib::json config, const fostlib::http::server::request &req) {
+    config = connection_config(config, req);
+    if (config.has_key("pool")) {
+        return pool_for(config)->lent();
+    } else {
+        return 0;
+    }
+}
@@ -0,0 +1,202 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "replicas.hpp"
+#include "shards.hpp"
+
+#include <fostgres/fostgres.hpp>
+
+#include <fost/log>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+
+
+namespace {
+
+
+    const fostlib::module c_replicas{fostgres::c_fostgres, "replicas"};
+
+
+    using clock_type = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+
+
+    /// What we last found out about how far behind a replica is. The lag
+    /// is empty until it has been measured, and when it couldn't be.
+    struct replica {
+        std::mutex mutex;
+        std::optional<clock_type::time_point> checked;
+        std::optional<double> lag;
+    };
+
+    std::mutex g_replicas_mut;
+    std::shared_ptr<replica> replica_for(const fostlib::json &server) {
+        static std::map<fostlib::string, std::shared_ptr<replica>> replicas;
+        auto const key = fostlib::json::unparse(server, false);
+        std::unique_lock<std::mutex> lock{g_replicas_mut};
+        auto &r = replicas[key];
+        if (not r) { r = std::make_shared<replica>(); }
+        return r;
+    }
+
+    /// Used to spread requests over replicas that are equally busy
+    std::atomic<std::size_t> g_next{};
+
+
+    /// The lag is only measured once every `check` seconds. Sets `measure`
+    /// when it is due to be measured again, after which other requests
+    /// carry on using the old figure until it has been. A replica whose lag
+    /// isn't known can't be used.
+    std::optional<double>
+            known_lag(replica &r, seconds const check, bool &measure) {
+        auto const now = clock_type::now();
+        std::unique_lock<std::mutex> lock{r.mutex};
+        measure = not r.checked || now - *r.checked >= check;
+        if (measure) { r.checked = now; }
+        return r.lag;
+    }
+
+    /// Seconds the replica is behind the primary. A replica that has
+    /// replayed all of the WAL it has received is up to date however long
+    /// ago the primary was last written to. Otherwise it is the time since
+    /// the last transaction it replayed. A server that isn't in recovery
+    /// is the primary itself.
+    std::optional<double> measure_lag(
+            fostgres::pooled_connection &cnx, replica &r) {
+        std::optional<double> lag;
+        try {
+            auto rs = cnx->exec(
+                    "SELECT CASE WHEN NOT pg_is_in_recovery() THEN 0 "
+                    "WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() "
+                    "THEN 0 ELSE EXTRACT(EPOCH FROM "
+                    "now() - pg_last_xact_replay_timestamp()) END::float8");
+            if (auto const l = fostlib::coerce<fostlib::nullable<double>>(
+                        (*rs.begin())[0]);
+                l) {
+                lag = *l;
+            }
+        } catch (...) {
+            std::unique_lock<std::mutex> lock{r.mutex};
+            r.lag = {};
+            throw;
+        }
+        std::unique_lock<std::mutex> lock{r.mutex};
+        r.lag = lag;
+        return lag;
+    }
+
+
+    bool reads(const fostlib::http::server::request &req) {
+        return req.method() == "GET" || req.method() == "HEAD";
+    }
+
+
+    /// Make the request's transaction read only when the end point asks
+    /// for it, and always on a replica. Replicas can't run `SERIALIZABLE`
+    /// transactions, and as nothing else can write to them a plain
+    /// `READ ONLY` transaction there is never cancelled anyway
+    fostgres::pooled_connection read_only(
+            fostgres::pooled_connection cnx,
+            const fostgres::endpoint &endpoint,
+            const fostlib::http::server::request &req,
+            bool const replica) {
+        if ((not endpoint.read_only && not replica) || not reads(req)) {
+            return cnx;
+        } else if (endpoint.deferrable && not replica) {
+            /// Setting up the connection has already run statements, and
+            /// the isolation level must be set before any of them
+            cnx.restart(
+                    "BEGIN ISOLATION LEVEL SERIALIZABLE, READ ONLY, "
+                    "DEFERRABLE",
+                    req);
+        } else {
+            cnx->exec("SET TRANSACTION READ ONLY");
+        }
+        return cnx;
+    }
+
+
+}
+
+
+fostgres::pooled_connection fostgres::connect(
+        const fostlib::json &configuration,
+        const view_plan &plan,
+        const match &m,
+        const fostlib::http::server::request &req) {
+    auto const &endpoint = m.plan();
+    if (endpoint.shard) {
+        return read_only(
+                pooled_connection{
+                        shard_configuration(
+                                configuration, plan.shards.get(), m),
+                        req},
+                endpoint, req, false);
+    }
+    auto const &replicas = configuration["replicas"];
+    auto const &servers = replicas["servers"];
+    if (not endpoint.replica || not servers.isarray() || servers.size() == 0
+        || not reads(req)) {
+        return read_only(
+                pooled_connection{configuration, req}, endpoint, req, false);
+    }
+    auto const max_lag =
+            fostlib::coerce<fostlib::nullable<double>>(replicas["max-lag"]);
+    seconds const check{fostlib::coerce<fostlib::nullable<double>>(
+                                replicas["lag-check"])
+                                .value_or(1)};
+
+    /// Order the replicas by how many requests they're serving, starting
+    /// from a different one each time so ties are shared out
+    struct candidate {
+        std::size_t in_use;
+        fostlib::json server, config;
+    };
+    std::vector<candidate> candidates;
+    auto const start = g_next++;
+    for (std::size_t index{}; index < servers.size(); ++index) {
+        auto const &server = servers[(start + index) % servers.size()];
+        auto config = server_configuration(configuration, server);
+        auto const busy = pooled_connection::in_use(config, req);
+        candidates.push_back({busy, server, std::move(config)});
+    }
+    std::stable_sort(
+            candidates.begin(), candidates.end(),
+            [](const candidate &l, const candidate &r) {
+                return l.in_use < r.in_use;
+            });
+
+    for (auto const &c : candidates) {
+        auto const r = replica_for(c.server);
+        bool measure = false;
+        if (max_lag) {
+            auto const lag = known_lag(*r, check, measure);
+            if (not measure && (not lag || *lag > *max_lag)) { continue; }
+        }
+        try {
+            pooled_connection cnx{c.config, req};
+            std::optional<double> lag;
+            if (measure) { lag = measure_lag(cnx, *r); }
+            if (not measure || (lag && *lag <= *max_lag)) {
+                return read_only(std::move(cnx), endpoint, req, true);
+            }
+            cnx.release();
+        } catch (std::exception &e) {
+            fostlib::log::warning(c_replicas)(
+                    "", "Could not use replica")("replica", c.server)(
+                    "exception", e.what());
+        }
+    }
+    return read_only(
+            pooled_connection{configuration, req}, endpoint, req, false);
+}
@@ -0,0 +1,35 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fostgres/plan.hpp>
+#include <fostgres/pool.hpp>
+
+
+namespace fostgres {
+
+
+    /// Borrow the connection for the request. Sharded end points use the
+    /// server for their shard key, throwing `unknown_shard` if there isn't
+    /// one. Otherwise `GET` and `HEAD` requests
+    /// for end points that allow it are sent to the least busy of the
+    /// view's `replicas` that isn't lagging too far behind. Everything
+    /// else, and any request no replica can take, uses the primary.
+    /// `GET` and `HEAD` requests sent to a replica, or to a `read-only` end
+    /// point, are given a read only transaction. It is never `DEFERRABLE`
+    /// on a replica.
+    pooled_connection connect(
+            const fostlib::json &configuration,
+            const view_plan &,
+            const match &,
+            const fostlib::http::server::request &);
+
+
+}
@@ -8,6 +8,7 @@
 
 #include <fostgres/fostgres.hpp>
 #include <fostgres/matcher.hpp>
+#include <fostgres/plan.hpp>
 #include <fostgres/response.hpp>
 
 #include <f5/threading/map.hpp>
@@ -34,6 +35,11 @@ fostgres::responder::responder(fostlib::string name, responder_function fn) {
 }
 
 
+fostgres::responder_function fostgres::responder::find(f5::u8view name) {
+    return g_responders().find(fostlib::string{name});
+}
+
+
 /*
     fostgres::response
 */
@@ -44,10 +50,13 @@ std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::response(
         fostlib::json const &config,
         match const &m,
         fostlib::http::server::request &req) {
-    auto fname = fostlib::coerce<fostlib::nullable<f5::u8view>>(
-            m.configuration["return"]);
-    if (fname) {
-        auto returner = g_responders().find(fname.value());
+    auto const &plan = m.plan();
+    if (plan.responder) {
+        return plan.responder(cnx, config, m, req);
+    } else if (plan.returns) {
+        /// The responder may have been registered after the view was
+        /// compiled
+        auto returner = responder::find(*plan.returns);
         if (returner) { return returner(cnx, config, m, req); }
     }
     return response_csj(cnx, config, m, req);
@@ -6,15 +6,29 @@
  */
 
 
+#include "body.hpp"
+#include "encode.hpp"
+#include "stream.hpp"
 #include "updater.hpp"
 
 #include <fostgres/fostgres.hpp>
+#include <fostgres/statements.hpp>
 
 #include <fost/csj.parser.hpp>
 #include <fost/json>
 #include <fost/log>
 #include <fost/parse/json.hpp>
 #include <fost/push_back>
+#include <fost/exception/parse_error.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
 
 
 namespace {
@@ -23,43 +37,26 @@ namespace {
     const fostgres::responder c_csj("csj", fostgres::response_csj);
 
 
-    void csv_string(std::string &into, const fostlib::string &str) {
-        if (str.find_first_of("\"\n,") != fostlib::string::npos) {
-            into += '"';
-            for (auto ch : str.memory()) {
-                switch (ch) {
-                case '"': into += ch; // Double up this one
-                default: into += ch;
-                }
-            }
-            into += '"';
-        } else {
-            into += static_cast<std::string_view>(str);
-        }
-    }
-
-    struct csj_mime : public fostlib::mime {
+    struct csj_mime : public fostgres::chunked_mime {
         enum class output { csj, csv } format;
-        mutable bool done = false;
         mutable std::vector<fostlib::string> columns;
-        mutable fostlib::pg::recordset rs;
+        mutable fostgres::row_source rows;
 
-        struct csj_iterator : public fostlib::mime::iterator_implementation {
+        struct csj_iterator : public fostgres::chunked_iterator {
             const csj_mime::output format;
-            fostlib::pg::recordset rs;
-            fostlib::pg::recordset::const_iterator iter, end;
-            std::string current;
-            bool sent_first = false;
+            std::vector<fostlib::string> columns;
+            fostgres::row_source rows;
+            bool sent_header = false;
 
             csj_iterator(
                     csj_mime::output format,
                     std::vector<fostlib::string> &&columns,
-                    fostlib::pg::recordset &&r)
+                    fostgres::row_source &&rows)
             : format(format),
-              rs(std::move(r)),
-              iter(rs.begin()),
-              end(rs.end()) {
-                current.reserve(64 * 1024);
+              columns(std::move(columns)),
+              rows(std::move(rows)) {}
+
+            void header(std::string &current) {
                 for (std::size_t index{0}; index < columns.size(); ++index) {
                     if (index) current += ',';
                     switch (format) {
@@ -67,67 +64,41 @@ namespace {
                         fostlib::json::unparse(current, columns[index]);
                         break;
                     case csj_mime::output::csv:
-                        csv_string(current, columns[index]);
+                        fostgres::encode_csv(
+                                current, f5::u8view{columns[index]});
                         break;
                     }
                 }
                 current += '\n';
-                if (iter != end) line();
             }
 
-            void line() {
-                while (iter != end && current.length() < 48 * 1024) {
-                    auto record = *iter;
-                    for (std::size_t index{0}; index < record.size(); ++index) {
-                        if (index) current += ',';
-                        switch (format) {
-                        case csj_mime::output::csj:
-                            fostlib::json::unparse(
-                                    current, record[index], false);
-                            break;
-                        case csj_mime::output::csv:
-                            if (record[index].isnull()) {
-                                // Do nothing -- null is an empty entry
-                            } else if (not fostlib::coerce<
-                                               fostlib::nullable<f5::u8view>>(
-                                               record[index])) {
-                                csv_string(
-                                        current,
-                                        fostlib::json::unparse(
-                                                record[index], false));
-                            } else {
-                                csv_string(
-                                        current,
-                                        fostlib::coerce<f5::u8view>(
-                                                record[index]));
-                            }
-                            break;
-                        }
-                    }
-                    current += '\n';
-                    ++iter;
+            bool fill(std::string &current) {
+                if (not sent_header) {
+                    sent_header = true;
+                    header(current);
+                    return true;
+                } else if (not rows.more()) {
+                    return false;
                 }
-            }
-
-            fostlib::const_memory_block operator()() {
-                if (!sent_first) {
-                    sent_first = true;
-                    return fostlib::const_memory_block(
-                            current.c_str(),
-                            current.c_str() + current.length());
-                } else if (iter == end) {
-                    return fostlib::const_memory_block();
-                } else {
-                    current.clear();
-                    line();
-                    return fostlib::const_memory_block(
-                            current.c_str(),
-                            current.c_str() + current.length());
+                const auto &record = rows.row();
+                for (std::size_t index{0}; index < record.size(); ++index) {
+                    if (index) current += ',';
+                    switch (format) {
+                    case csj_mime::output::csj:
+                        fostgres::encode_json(current, record[index]);
+                        break;
+                    case csj_mime::output::csv:
+                        fostgres::encode_csv(current, record[index]);
+                        break;
+                    }
                 }
+                current += '\n';
+                rows.next();
+                return true;
             }
         };
 
-        f5::u8view mime_type(fostlib::string const &accept) {
+        static f5::u8view mime_type(fostlib::string const &accept) {
             const auto csj_pos = accept.find("application/csj");
             const auto csv_pos = accept.find("application/csv");
             if (csj_pos < csv_pos) {
@@ -139,34 +110,23 @@ namespace {
             }
         }
 
+        static output format_for(fostlib::string const &accept) {
+            return mime_type(accept) == "application/csv" ? output::csv
+                                                           : output::csj;
+        }
+
         csj_mime(
                 fostlib::string const &accept,
                 std::vector<fostlib::string> &&cols,
-                fostlib::pg::recordset &&rs)
-        : mime(fostlib::mime::mime_headers(), mime_type(accept)),
-          format(output::csj),
+                fostgres::row_source &&rows)
+        : chunked_mime(mime_type(accept)),
+          format(format_for(accept)),
           columns(std::move(cols)),
-          rs(std::move(rs)) {
-            if (headers()["Content-Type"].value() == "application/csv") {
-                format = output::csv;
-            }
-        }
-
-        std::unique_ptr<iterator_implementation> iterator() const {
-            if (done) {
-                throw fostlib::exceptions::not_implemented(
-                        __func__, "The data can only be iterated over once");
-            }
-            done = true;
-            return std::unique_ptr<iterator_implementation>(new csj_iterator(
-                    format, std::move(columns), std::move(rs)));
-        }
+          rows(std::move(rows)) {}
 
-        bool boundary_is_ok(const fostlib::string &) const {
-            throw fostlib::exceptions::not_implemented(__func__);
-        }
-        std::ostream &print_on(std::ostream &) const {
-            throw fostlib::exceptions::not_implemented(__func__);
+        std::unique_ptr<fostgres::chunked_iterator> body() const {
+            return std::make_unique<csj_iterator>(
+                    format, std::move(columns), std::move(rows));
         }
     };
 
@@ -176,7 +136,9 @@ namespace {
                 fostlib::json const &config,
                 fostgres::match const &m,
                 fostlib::http::server::request &req) {
-        auto data = fostgres::select_data(cnx, m.configuration["GET"], m, req);
+        auto [command, arguments] =
+                fostgres::select_command(m.plan().get, m, req);
+        auto data = fostgres::select_rows(cnx, m, command, arguments);
         return std::make_pair(
                 boost::shared_ptr<fostlib::mime>(new csj_mime(
                         req.headers()["Accept"].value(), std::move(data.first),
@@ -185,6 +147,251 @@ namespace {
     }
 
 
+    /// A row of the CSJ body after the column data has been worked out and
+    /// the schemas have been checked
+    struct prepared_row {
+        fostlib::json body;
+        /// The row number in the body
+        std::size_t index = 0;
+        /// False until the data has been worked out and checked
+        bool prepared = false;
+        fostgres::updater::intermediate_data data;
+        fostgres::updater::action action;
+        std::pair<boost::shared_ptr<fostlib::mime>, int> error;
+    };
+    void prepare(
+            fostgres::updater &handler,
+            prepared_row &p,
+            bool const use_action) {
+        p.data = handler.data(p.body);
+        p.action = use_action ? handler.perform()
+                              : fostgres::updater::action::insertable;
+        if (p.action == fostgres::updater::action::updateable) {
+            p.error = handler.check_update(p.body, p.data, p.index);
+        } else {
+            p.error = handler.check_insert(p.body, p.data, p.index);
+        }
+        p.prepared = true;
+    }
+    /// The same as above, but without anything that uses the database or
+    /// the request. Only for plans whose columns are all pure.
+    void prepare(
+            const fostlib::json &config,
+            const fostgres::method_plan &plan,
+            const std::vector<fostlib::string> &arguments,
+            prepared_row &p,
+            bool const use_action) {
+        using fostgres::updater;
+        auto action = updater::action::do_default;
+        p.data = updater::data(plan, arguments, p.body, action);
+        p.action = use_action ? action : updater::action::insertable;
+        if (p.action == updater::action::updateable) {
+            p.error = updater::check_update(
+                    config, plan, p.body, p.data, p.index);
+        } else {
+            p.error = updater::check_insert(
+                    config, plan, p.body, p.data, p.index);
+        }
+        p.prepared = true;
+    }
+
+
+    /// Bulk loading is used when it's been turned on and there is no
+    /// `returning` data that would need each row to be written separately
+    std::optional<fostgres::bulk_loader> bulk_for(
+            fostlib::pg::connection &cnx,
+            const std::shared_ptr<const fostgres::method_plan> &plan) {
+        if (fostgres::bulk_loader::wanted(*plan)) {
+            return std::optional<fostgres::bulk_loader>{
+                    std::in_place, cnx, plan};
+        } else {
+            return {};
+        }
+    }
+
+
+    /// The number of rows each worker prepares at a time
+    constexpr std::size_t c_parallel_rows = 1000;
+
+
+    /// Threads shared by all of the requests that prepare their rows in
+    /// parallel, so the number of threads doesn't grow with the number of
+    /// requests
+    class row_workers {
+      public:
+        explicit row_workers(std::size_t const count) {
+            for (std::size_t index{}; index < count; ++index) {
+                threads.emplace_back([this]() { run(); });
+            }
+        }
+        ~row_workers() {
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                stopping = true;
+            }
+            signal.notify_all();
+            for (auto &thread : threads) { thread.join(); }
+        }
+
+        template<typename F>
+        auto submit(F f) {
+            auto task = std::make_shared<std::packaged_task<decltype(f())()>>(
+                    std::move(f));
+            auto result = task->get_future();
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                queue.emplace_back([task]() { (*task)(); });
+            }
+            signal.notify_one();
+            return result;
+        }
+
+      private:
+        std::mutex mutex;
+        std::condition_variable signal;
+        std::deque<std::function<void()>> queue;
+        bool stopping = false;
+        std::vector<std::thread> threads;
+
+        void run() {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock{mutex};
+                    signal.wait(lock, [this]() {
+                        return stopping || not queue.empty();
+                    });
+                    if (queue.empty()) { return; }
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                job();
+            }
+        }
+    };
+    row_workers &g_row_workers() {
+        static row_workers workers{
+                std::max(2u, std::thread::hardware_concurrency())};
+        return workers;
+    }
+
+
+    /// Prepare the rows of the body and pass them to `write` in order.
+    /// Rows can be parsed on several threads. The workers only ever see
+    /// the body and the compiled plan, so when the plan's columns are all
+    /// pure they also work out the column data and check the schemas.
+    /// Otherwise that is done here, as is all writing. Returns the first
+    /// error, which is always for the lowest numbered row that failed.
+    template<typename Write>
+    std::pair<boost::shared_ptr<fostlib::mime>, int> each_row(
+            fostgres::match const &m,
+            const std::shared_ptr<const fostgres::method_plan> &plan,
+            fostgres::updater &handler,
+            const fostlib::csj::parser &data,
+            bool const use_action,
+            std::size_t &records,
+            Write write) {
+        if (plan->parallel < 2u) {
+            for (auto line(data.begin()), e(data.end()); line != e; ++line) {
+                prepared_row row{line.as_json(), records};
+                prepare(handler, row, use_action);
+                if (row.error.first) return row.error;
+                if (auto error = write(row); error.first) return error;
+                ++records;
+            }
+            return {};
+        }
+
+        auto const config = m.configuration;
+        auto const arguments = m.arguments;
+        /// Set once the rows are no longer wanted, so blocks that haven't
+        /// started yet don't do any work
+        std::atomic<bool> abandoned{false};
+        auto const work = [&data, &config, &arguments, &abandoned, plan,
+                           use_action](
+                                  std::size_t const first,
+                                  std::size_t const last) {
+            std::vector<std::optional<prepared_row>> rows;
+            if (abandoned) { return rows; }
+            rows.reserve(last - first);
+            for (std::size_t index{first}; index < last; ++index) {
+                try {
+                    auto line = data.parse_row(index);
+                    if (line.empty()) {
+                        rows.emplace_back();
+                        continue;
+                    }
+                    rows.emplace_back(prepared_row{data.as_json(line), index});
+                    if (plan->pure_columns) {
+                        prepare(config, *plan, arguments, *rows.back(),
+                                use_action);
+                    }
+                } catch (fostlib::exceptions::exception &e) {
+                    if (not e.data().has_key("csj")) {
+                        fostlib::insert(
+                                e.data(), "csj", "line", int64_t(index + 2u));
+                    }
+                    throw;
+                }
+                if (rows.back()->error.first) { break; }
+            }
+            return rows;
+        };
+
+        using blocks = std::deque<
+                std::future<std::vector<std::optional<prepared_row>>>>;
+        std::size_t next{};
+        blocks pending;
+        /// The blocks use the body and the configuration from this stack
+        /// frame, so they must all be finished before it goes
+        struct finish_blocks {
+            std::atomic<bool> &abandoned;
+            blocks &pending;
+            ~finish_blocks() {
+                abandoned = true;
+                for (auto &block : pending) { block.wait(); }
+            }
+        } const finish{abandoned, pending};
+        auto const launch = [&]() {
+            auto const first = next;
+            auto const last = std::min(data.rows(), first + c_parallel_rows);
+            next = last;
+            pending.push_back(g_row_workers().submit(
+                    [&work, first, last]() { return work(first, last); }));
+        };
+        while (pending.size() < plan->parallel && next < data.rows()) {
+            launch();
+        }
+        bool blank = false;
+        while (pending.size()) {
+            auto rows = pending.front().get();
+            pending.pop_front();
+            if (next < data.rows()) { launch(); }
+            for (auto &row : rows) {
+                if (not row) {
+                    blank = true;
+                    continue;
+                } else if (blank) {
+                    fostlib::exceptions::parse_error e{
+                            "Empty line embedded in CSJ file"};
+                    fostlib::insert(
+                            e.data(), "csj", "line", int64_t(row->index + 2u));
+                    throw e;
+                }
+                if (not row->prepared) { prepare(handler, *row, use_action); }
+                if (row->error.first) {
+                    return row->error;
+                } else if (auto error = write(*row); error.first) {
+                    return error;
+                } else {
+                    ++records;
+                }
+            }
+        }
+        return {};
+    }
+
+
     std::pair<boost::shared_ptr<fostlib::mime>, int>
             patch(fostlib::pg::connection &cnx,
                   fostlib::json const &config,
@@ -196,29 +403,41 @@ namespace {
         std::size_t records{};
 
         // We're going to need these items later
-        fostgres::updater handler{m.configuration["PATCH"], cnx, m, req};
+        auto const patch_plan = m.plan().method("PATCH");
+        fostgres::updater handler{patch_plan, cnx, m, req};
+        bool const batching = handler.batching();
+        auto bulk = bulk_for(cnx, patch_plan);
 
         // Interpret body as UTF8 and split into lines. Ensure it's not empty
-        fostlib::csj::parser data(f5::u8view(req.data()->data()));
+        fostlib::csj::parser data(fostgres::request_text(req));
         logger("header", data.header());
 
         // Parse each line and send it to the database
-        for (auto line(data.begin()), e(data.end()); line != e; ++line) {
-            std::pair<boost::shared_ptr<fostlib::mime>, int> error;
-            auto linejson = line.as_json();
-            auto linedata = handler.data(linejson);
-            switch (handler.perform()) {
-            case fostgres::updater::action::do_default: [[fallthrough]];
-            case fostgres::updater::action::insertable:
-                error = handler.insert(linejson, linedata, records);
-                break;
-            case fostgres::updater::action::updateable:
-                error = handler.update(linejson, linedata, records);
-                break;
-            }
-            if (error.first) return error;
-            ++records;
-        }
+        auto error = each_row(
+                m, patch_plan, handler, data, true, records,
+                [&](const prepared_row &row)
+                        -> std::pair<boost::shared_ptr<fostlib::mime>, int> {
+                    if (row.action == fostgres::updater::action::updateable) {
+                        /// Keep the writes in the same order as the body
+                        if (bulk) { bulk->apply(); }
+                        if (batching) {
+                            handler.queue_update(row.data);
+                        } else {
+                            handler.write_update(row.data);
+                        }
+                    } else if (bulk) {
+                        handler.flush();
+                        bulk->add(row.data);
+                    } else if (batching) {
+                        handler.queue_insert(row.data);
+                    } else {
+                        return handler.write_insert(row.data);
+                    }
+                    return {};
+                });
+        if (error.first) return error;
+        if (bulk) { bulk->apply(); }
+        handler.flush();
         cnx.commit();
         fostlib::insert(work_done, "records", records);
         boost::shared_ptr<fostlib::mime> response(new fostlib::text_body(
@@ -236,31 +455,56 @@ namespace {
         auto logger = fostlib::log::debug(fostgres::c_fostgres);
         logger("", "CSJ PUT");
 
-        fostgres::updater handler{m.configuration["PUT"], cnx, m, req};
+        auto const put_plan = m.plan().method("PUT");
+        if (not put_plan->delete_unseen
+            && (not put_plan->existing || not put_plan->delete_sql)) {
+            throw fostlib::exceptions::not_implemented(
+                    __func__,
+                    "CSJ PUT configuration must have 'existing' and 'delete' "
+                    "SQL, or 'delete-unseen' SQL",
+                    put_plan->configuration);
+        }
+        fostgres::updater handler{put_plan, cnx, m, req};
+        bool const batching = handler.batching();
+        auto bulk = bulk_for(cnx, put_plan);
         fostlib::json work_done{fostlib::json::object_t()};
 
-        auto const select_sql =
-                fostlib::coerce<f5::u8view>(m.configuration["PUT"]["existing"]);
-        fostgres::put_records_seen dbkeys{cnx, select_sql, m, req};
-        fostlib::insert(work_done, "selected", dbkeys.size());
-        logger("selected", dbkeys.size());
+        auto dbkeys = put_plan->delete_unseen
+                ? fostgres::put_records_seen{cnx, m}
+                : fostgres::put_records_seen{
+                        cnx, f5::u8view{*put_plan->existing}, m, req};
+        if (not put_plan->delete_unseen) {
+            fostlib::insert(work_done, "selected", dbkeys.size());
+            logger("selected", dbkeys.size());
+        }
 
         // Process the incoming data and put it into the database. Also
         // record the keys seen
         {
             // Interpret body as UTF8 and split into lines. Ensure it's not empty
-            fostlib::csj::parser data(f5::u8view(req.data()->data()));
+            fostlib::csj::parser data(fostgres::request_text(req));
             logger("header", data.header());
             std::size_t records{};
 
             // Parse each line and send it to the database
-            for (auto line(data.begin()), e(data.end()); line != e; ++line) {
-                auto [error, inserted] =
-                        handler.upsert(line.as_json(), records);
-                if (error.first) return error;
-                ++records;
-                dbkeys.record(inserted.first);
-            }
+            auto error = each_row(
+                    m, put_plan, handler, data, false, records,
+                    [&](const prepared_row &row) {
+                        std::pair<boost::shared_ptr<fostlib::mime>, int>
+                                error{};
+                        if (bulk) {
+                            bulk->add(row.data);
+                        } else if (batching) {
+                            handler.queue_insert(row.data);
+                        } else {
+                            error = handler.write_insert(row.data);
+                        }
+                        dbkeys.record(row.data.first);
+                        return error;
+                    });
+            if (error.first) return error;
+            if (bulk) { bulk->apply(); }
+            handler.flush();
             fostlib::insert(work_done, "records", records);
             logger("records", records);
         }
@@ -268,9 +512,12 @@ namespace {
         // Look through the initial keys to find any that weren't in the
         // incoming data so the rows can be deleted
         {
-            auto const sql = fostlib::coerce<f5::u8view>(
-                    m.configuration["PUT"]["delete"]);
-            std::size_t const deleted = dbkeys.delete_left_over_records(sql);
+            std::size_t const deleted = put_plan->delete_unseen
+                    ? dbkeys.delete_unseen_records(
+                            f5::u8view{*put_plan->delete_unseen},
+                            put_plan->delete_unseen_returns)
+                    : dbkeys.delete_left_over_records(
+                            f5::u8view{*put_plan->delete_sql});
             fostlib::insert(work_done, "deleted", deleted);
             logger("deleted", deleted);
         }
@@ -289,9 +536,13 @@ namespace {
                 fostlib::json const &config,
                 fostgres::match const &m,
                 fostlib::http::server::request &req) {
-        auto sql = fostlib::coerce<fostlib::string>(m.configuration["DELETE"]);
-        auto sp = cnx.procedure(fostlib::coerce<fostlib::utf8_string>(sql));
-        sp.exec(m.arguments);
+        auto const &sql = m.plan().del;
+        if (not sql) {
+            throw fostlib::exceptions::not_implemented(
+                    __func__, "There is no DELETE configuration",
+                    m.configuration);
+        }
+        fostgres::exec(cnx, m, f5::u8view{*sql}, m.arguments);
         cnx.commit();
         boost::shared_ptr<fostlib::mime> response(new fostlib::text_body(""));
         return std::make_pair(response, 200);
@@ -6,9 +6,10 @@
  */
 
 
-#include <fost/insert>
-#include <fost/push_back>
-#include <fostgres/matcher.hpp>
+#include "encode.hpp"
+#include "stream.hpp"
+
+#include <fostgres/plan.hpp>
 #include <fostgres/response.hpp>
 #include <fostgres/sql.hpp>
 
@@ -16,49 +17,99 @@
 namespace {
 
 
+    struct json_csv_mime : public fostgres::chunked_mime {
+        bool const pretty;
+        mutable std::vector<fostlib::string> columns;
+        mutable fostgres::row_source rows;
+
+        struct json_csv_iterator : public fostgres::chunked_iterator {
+            bool const pretty;
+            std::vector<fostlib::string> columns;
+            fostgres::row_source rows;
+            bool started = false, first = true;
+
+            json_csv_iterator(
+                    bool pretty,
+                    std::vector<fostlib::string> &&columns,
+                    fostgres::row_source &&rows)
+            : pretty(pretty),
+              columns(std::move(columns)),
+              rows(std::move(rows)) {}
+
+            bool fill(std::string &current) {
+                /// Appends the pretty or the compact form of the text
+                auto const add = [&](const char *p, const char *c) {
+                    current += pretty ? p : c;
+                };
+                if (not started) {
+                    started = true;
+                    add("{\n    \"@context\": ", "{\"@context\":");
+                    fostlib::json::unparse(
+                            current,
+                            fostlib::json{"http://www.kirit.com/fostgres/"
+                                          "context/rows"},
+                            false);
+                    /// An empty array has always been sent as `null`
+                    add(",\n    \"columns\": ", ",\"columns\":");
+                    if (columns.empty()) { current += "null"; }
+                    for (std::size_t index{}; index < columns.size(); ++index) {
+                        add(index ? ", " : "[", index ? "," : "[");
+                        fostlib::json::unparse(current, columns[index]);
+                    }
+                    if (not columns.empty()) { current += ']'; }
+                    add(",\n    \"rows\": ", ",\"rows\":");
+                    return true;
+                } else if (not rows.more()) {
+                    add(first ? "null\n}\n" : "\n    ]\n}\n",
+                        first ? "null}" : "]}");
+                    return false;
+                }
+                add(first ? "[\n        " : ",\n        ", first ? "[" : ",");
+                first = false;
+                const auto &record = rows.row();
+                if (record.size() == 0) { current += "null"; }
+                for (std::size_t index{0}; index < record.size(); ++index) {
+                    add(index ? ", " : "[", index ? "," : "[");
+                    fostgres::encode_json(current, record[index]);
+                }
+                if (record.size()) { current += ']'; }
+                rows.next();
+                return true;
+            }
+        };
+
+        json_csv_mime(
+                bool pretty,
+                std::vector<fostlib::string> &&cols,
+                fostgres::row_source &&rows)
+        : chunked_mime("application/json"),
+          pretty(pretty),
+          columns(std::move(cols)),
+          rows(std::move(rows)) {}
+
+        std::unique_ptr<fostgres::chunked_iterator> body() const {
+            return std::make_unique<json_csv_iterator>(
+                    pretty, std::move(columns), std::move(rows));
+        }
+    };
+
+
     std::pair<boost::shared_ptr<fostlib::mime>, int>
             get(fostlib::pg::connection &cnx,
                 fostlib::json const &config,
                 fostgres::match const &m,
                 fostlib::http::server::request &req) {
-        auto data = m.arguments.size() ? fostgres::sql(
-                            cnx,
-                            fostlib::coerce<fostlib::string>(
-                                    m.configuration["GET"]),
-                            m.arguments)
-                                       : fostgres::sql(
-                                               cnx,
-                                               fostlib::coerce<fostlib::string>(
-                                                       m.configuration["GET"]));
-        fostlib::json result;
-        fostlib::insert(
-                result, "@context",
-                "http://www.kirit.com/fostgres/context/rows");
-        { // Start with the header row
-            fostlib::json header;
-            for (const auto &heading : data.first) {
-                fostlib::push_back(header, heading);
-            }
-            fostlib::insert(result, "columns", header);
-        }
-        { // Continue with rows
-            fostlib::json rows;
-            for (auto const &record : data.second) {
-                fostlib::json row;
-                for (std::size_t index{0}; index < record.size(); ++index) {
-                    fostlib::push_back(row, record[index]);
-                }
-                fostlib::push_back(rows, row);
-            }
-            fostlib::insert(result, "rows", rows);
-        }
+        auto [command, arguments] =
+                fostgres::select_command(m.plan().get, m, req);
+        auto data = fostgres::select_rows(cnx, m, command, arguments);
         bool const pretty =
                 fostlib::coerce<fostlib::nullable<bool>>(config["pretty"])
                         .value_or(true);
-        boost::shared_ptr<fostlib::mime> response(new fostlib::text_body(
-                fostlib::json::unparse(result, pretty),
-                fostlib::mime::mime_headers(), "application/json"));
-        return std::make_pair(response, 200);
+        return std::make_pair(
+                boost::shared_ptr<fostlib::mime>(new json_csv_mime(
+                        pretty, std::move(data.first),
+                        std::move(data.second))),
+                200);
     }
 
 
@@ -0,0 +1,146 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "log.hpp"
+#include "stream.hpp"
+
+#include <fostgres/fostgres.hpp>
+#include <fostgres/iteration.hpp>
+#include <fostgres/plan.hpp>
+#include <fostgres/response.hpp>
+#include <fostgres/sql.hpp>
+#include <fostgres/statements.hpp>
+
+#include <fost/insert>
+#include <fost/push_back>
+
+#include <cctype>
+
+
+namespace {
+
+
+    /// Sends JSON text from the database exactly as it was received
+    struct raw_json_mime : public fostgres::chunked_mime {
+        /// The text is kept in the JSON value it arrived in
+        mutable fostlib::json text;
+
+        struct raw_iterator : public fostgres::chunked_iterator {
+            fostlib::json text;
+            f5::u8view remaining;
+
+            raw_iterator(fostlib::json t)
+            : text(std::move(t)),
+              remaining(fostlib::coerce<f5::u8view>(text)) {}
+
+            bool fill(std::string &current) {
+                auto const size =
+                        std::min(remaining.bytes(), std::size_t(16 * 1024));
+                current.append(remaining.data(), size);
+                remaining = f5::u8view{
+                        remaining.data() + size, remaining.bytes() - size};
+                return remaining.bytes() > 0;
+            }
+        };
+
+        raw_json_mime(fostlib::json t)
+        : chunked_mime("application/json"), text(std::move(t)) {}
+
+        std::unique_ptr<fostgres::chunked_iterator> body() const {
+            return std::make_unique<raw_iterator>(std::move(text));
+        }
+    };
+
+
+    /// Remove any trailing semicolon so the command can go in a sub-query
+    std::string_view without_terminator(std::string_view sql) {
+        while (not sql.empty()
+               && (sql.back() == ';'
+                   || std::isspace(static_cast<unsigned char>(sql.back())))) {
+            sql.remove_suffix(1);
+        }
+        return sql;
+    }
+
+
+    std::pair<boost::shared_ptr<fostlib::mime>, int>
+            get(fostlib::pg::connection &cnx,
+                fostlib::json const &config,
+                fostgres::match const &m,
+                fostlib::http::server::request &req) {
+        auto [command, arguments] =
+                fostgres::select_command(m.plan().get, m, req);
+        auto const inner =
+                without_terminator(static_cast<std::string_view>(command));
+        fostgres::log_debug([&](auto &&logger) {
+            logger("", "Raw JSON GET")("command", command)("args", arguments);
+        });
+        /// The column alias below would quietly send only the first of
+        /// several columns. Fetching no rows still describes them all
+        std::string describe{"SELECT * FROM ("};
+        describe += inner;
+        describe += ") AS fg_raw_q LIMIT 0";
+        auto const shape = fostgres::column_names(
+                fostgres::exec(cnx, m, f5::u8view{describe}, arguments));
+        if (shape.first.size() != 1) {
+            fostlib::exceptions::not_implemented error{
+                    __PRETTY_FUNCTION__,
+                    "The json-raw GET SQL must return exactly one column"};
+            for (auto const &c : shape.first) {
+                fostlib::push_back(error.data(), "columns", c);
+            }
+            throw error;
+        }
+        /// Casting to text stops the value being parsed into JSON on its
+        /// way out of the database
+        std::string sql{"SELECT fg_raw::text FROM ("};
+        sql += inner;
+        sql += ") AS fg_raw_q(fg_raw)";
+        auto rs = fostgres::exec(cnx, m, f5::u8view{sql}, arguments);
+
+        auto row = rs.begin();
+        if (row == rs.end()) {
+            fostlib::json result;
+            fostlib::insert(result, "error", "Not found");
+            boost::shared_ptr<fostlib::mime> response(new fostlib::text_body(
+                    fostlib::json::unparse(result, true),
+                    fostlib::mime::mime_headers(), "application/json"));
+            return std::make_pair(response, 404);
+        }
+        fostlib::json text = (*row)[0];
+        if (++row != rs.end()) {
+            throw fostlib::exceptions::not_implemented{
+                    __PRETTY_FUNCTION__, "Too many rows returned"};
+        } else if (text.isnull()) {
+            text = fostlib::json{"null"};
+        }
+        return std::make_pair(
+                boost::shared_ptr<fostlib::mime>(
+                        new raw_json_mime(std::move(text))),
+                200);
+    }
+
+
+    std::pair<boost::shared_ptr<fostlib::mime>, int> response_json_raw(
+            fostlib::pg::connection &cnx,
+            fostlib::json const &config,
+            fostgres::match const &m,
+            fostlib::http::server::request &req) {
+        if (req.method() == "GET" || req.method() == "HEAD") {
+            return get(cnx, config, m, req);
+        } else {
+            throw fostlib::exceptions::not_implemented(
+                    __FUNCTION__, "Invalid HTTP method -- should return 405");
+        }
+    }
+
+
+    const fostgres::responder c_json_raw("json-raw", response_json_raw);
+
+
+}
@@ -0,0 +1,119 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "layout.hpp"
+#include "stream.hpp"
+
+#include <fostgres/plan.hpp>
+#include <fostgres/response.hpp>
+#include <fostgres/sql.hpp>
+
+
+namespace {
+
+
+    /// Sends each row as a JSON object. Either one object per line
+    /// (NDJSON), or as the items of a JSON array
+    struct rows_mime : public fostgres::chunked_mime {
+        enum class output { ndjson, array } format;
+        mutable std::vector<fostlib::string> columns;
+        mutable fostgres::row_source rows;
+
+        struct rows_iterator : public fostgres::chunked_iterator {
+            output const format;
+            fostgres::column_layout const layout;
+            fostgres::row_source rows;
+            bool started = false, first = true;
+
+            rows_iterator(
+                    output format,
+                    const std::vector<fostlib::string> &columns,
+                    fostgres::row_source &&rows)
+            : format(format),
+              layout(columns),
+              rows(std::move(rows)) {}
+
+            bool fill(std::string &current) {
+                if (not started) {
+                    started = true;
+                    if (format == output::array) { current += '['; }
+                }
+                if (not rows.more()) {
+                    if (format == output::array) {
+                        current += first ? "]\n" : "\n]\n";
+                    }
+                    return false;
+                }
+                if (format == output::array) {
+                    current += first ? "\n" : ",\n";
+                }
+                first = false;
+                layout.encode(current, rows.row());
+                if (format == output::ndjson) { current += '\n'; }
+                rows.next();
+                return true;
+            }
+        };
+
+        rows_mime(
+                output format,
+                std::vector<fostlib::string> &&cols,
+                fostgres::row_source &&rows)
+        : chunked_mime(
+                format == output::ndjson ? "application/x-ndjson"
+                                         : "application/json"),
+          format(format),
+          columns(std::move(cols)),
+          rows(std::move(rows)) {}
+
+        std::unique_ptr<fostgres::chunked_iterator> body() const {
+            return std::make_unique<rows_iterator>(
+                    format, columns, std::move(rows));
+        }
+    };
+
+
+    std::pair<boost::shared_ptr<fostlib::mime>, int>
+            get(rows_mime::output const format,
+                fostlib::pg::connection &cnx,
+                fostgres::match const &m,
+                fostlib::http::server::request &req) {
+        if (req.method() != "GET" && req.method() != "HEAD") {
+            throw fostlib::exceptions::not_implemented(
+                    __FUNCTION__, "Invalid HTTP method -- should return 405");
+        }
+        auto [command, arguments] =
+                fostgres::select_command(m.plan().get, m, req);
+        auto data = fostgres::select_rows(cnx, m, command, arguments);
+        return std::make_pair(
+                boost::shared_ptr<fostlib::mime>(new rows_mime(
+                        format, std::move(data.first),
+                        std::move(data.second))),
+                200);
+    }
+
+
+    const fostgres::responder c_ndjson(
+            "ndjson",
+            [](fostlib::pg::connection &cnx,
+               fostlib::json const &,
+               fostgres::match const &m,
+               fostlib::http::server::request &req) {
+                return get(rows_mime::output::ndjson, cnx, m, req);
+            });
+    const fostgres::responder c_json_array(
+            "json-array",
+            [](fostlib::pg::connection &cnx,
+               fostlib::json const &,
+               fostgres::match const &m,
+               fostlib::http::server::request &req) {
+                return get(rows_mime::output::array, cnx, m, req);
+            });
+
+
+}
@@ -6,10 +6,13 @@
  */
 
 
+#include "body.hpp"
+#include "layout.hpp"
 #include "updater.hpp"
 
 #include <fostgres/datum.hpp>
 #include <fostgres/fostgres.hpp>
+#include <fostgres/statements.hpp>
 
 #include <fost/insert>
 #include <fost/log>
@@ -24,7 +27,7 @@ namespace {
                 const fostgres::match &m,
                 fostlib::http::server::request &req) {
         return fostgres::response_object(
-                select_data(cnx, m.configuration["GET"], m, req), config);
+                select_data(cnx, m.plan().get, m, req), config);
     }
 
     fostlib::json
@@ -54,33 +57,54 @@ namespace {
             const fostlib::json &config,
             const fostgres::match &m,
             fostlib::http::server::request &req,
-            const fostlib::json &put_config,
+            const std::shared_ptr<const fostgres::method_plan> &put_plan,
             const fostlib::json &body) {
-        fostgres::updater handler{put_config, cnx, m, req};
+        if (not put_plan->delete_unseen
+            && (not put_plan->existing || not put_plan->delete_sql)) {
+            throw fostlib::exceptions::not_implemented(
+                    __func__,
+                    "PUT of an array must have 'existing' and 'delete' SQL, "
+                    "or 'delete-unseen' SQL",
+                    put_plan->configuration);
+        }
+        fostgres::updater handler{put_plan, cnx, m, req};
 
-        auto const select_sql =
-                fostlib::coerce<f5::u8view>(put_config["existing"]);
-        fostgres::put_records_seen dbkeys{cnx, select_sql, m, req};
+        auto dbkeys = put_plan->delete_unseen
+                ? fostgres::put_records_seen{cnx, m}
+                : fostgres::put_records_seen{
+                        cnx, f5::u8view{*put_plan->existing}, m, req};
 
-        auto const array_position =
-                fostlib::coerce<fostlib::jcursor>(put_config["array"]);
         std::size_t records{};
-        for (auto const &item : body[array_position]) {
-            if (auto const error = fostgres::schema_check(
-                        cnx, config, m, req, put_config, item,
-                        fostlib::jcursor{});
+        for (auto const &item : body[*put_plan->array]) {
+            if (auto const error =
+                        fostgres::schema_check(config, *put_plan, item);
                 error.first || error.second) {
                 return error;
             }
-            auto [error, inserted] = handler.upsert(item, records);
-            if (error.first || error.second) return error;
-            ++records;
-            dbkeys.record(inserted.first);
+            if (handler.batching()) {
+                auto const data = handler.data(item);
+                auto error = handler.check_insert(item, data, records);
+                if (error.first || error.second) return error;
+                handler.queue_insert(data);
+                ++records;
+                dbkeys.record(data.first);
+            } else {
+                auto [error, inserted] = handler.upsert(item, records);
+                if (error.first || error.second) return error;
+                ++records;
+                dbkeys.record(inserted.first);
+            }
         }
+        handler.flush();
 
-        auto const delete_sql =
-                fostlib::coerce<f5::u8view>(put_config["delete"]);
-        dbkeys.delete_left_over_records(delete_sql);
+        if (put_plan->delete_unseen) {
+            dbkeys.delete_unseen_records(
+                    f5::u8view{*put_plan->delete_unseen},
+                    put_plan->delete_unseen_returns);
+        } else {
+            dbkeys.delete_left_over_records(
+                    f5::u8view{*put_plan->delete_sql});
+        }
 
         return std::make_pair(nullptr, 0);
     }
@@ -89,13 +113,13 @@ namespace {
             const fostlib::json &config,
             const fostgres::match &m,
             fostlib::http::server::request &req,
-            const fostlib::json &put_config,
+            const std::shared_ptr<const fostgres::method_plan> &put_plan,
             const fostlib::json &body) {
-        auto error = fostgres::schema_check(
-                cnx, config, m, req, put_config, body, fostlib::jcursor{});
+        auto const &put_config = put_plan->configuration;
+        auto error = fostgres::schema_check(config, *put_plan, body);
         if (error.first || error.second) return error;
         if (put_config.has_key("columns")) {
-            return fostgres::updater{put_config, cnx, m, req}.upsert(body).first;
+            return fostgres::updater{put_plan, cnx, m, req}.upsert(body).first;
         } else {
             fostlib::log::warning(fostgres::c_fostgres)(
                     "",
@@ -117,12 +141,12 @@ namespace {
             const fostlib::json &config,
             const fostgres::match &m,
             fostlib::http::server::request &req,
-            const fostlib::json &put_config,
+            const std::shared_ptr<const fostgres::method_plan> &put_plan,
             const fostlib::json &body) {
-        if (put_config.has_key("array")) {
-            return proc_put_array(cnx, config, m, req, put_config, body);
+        if (put_plan->array) {
+            return proc_put_array(cnx, config, m, req, put_plan, body);
         } else {
-            return proc_put_object(cnx, config, m, req, put_config, body);
+            return proc_put_object(cnx, config, m, req, put_plan, body);
         }
     }
     std::pair<boost::shared_ptr<fostlib::mime>, int>
@@ -130,17 +154,11 @@ namespace {
                 const fostlib::json &config,
                 const fostgres::match &m,
                 fostlib::http::server::request &req) {
-        fostlib::json body{fostlib::json::parse(fostlib::coerce<fostlib::string>(
-                fostlib::coerce<fostlib::utf8_string>(req.data()->data())))};
-        auto put_config = m.configuration["PUT"];
+        fostlib::json body{fostgres::request_json(req)};
         std::pair<boost::shared_ptr<fostlib::mime>, int> returning;
-        if (put_config.isobject()) {
-            returning = proc_put(cnx, config, m, req, put_config, body);
-        } else if (put_config.isarray()) {
-            for (const auto &cfg : put_config) {
-                returning = proc_put(cnx, config, m, req, cfg, body);
-                if (returning.second >= 400) break;
-            }
+        for (const auto &put_plan : m.plan().put) {
+            returning = proc_put(cnx, config, m, req, put_plan, body);
+            if (returning.second >= 400) break;
         }
         if (returning.second < 400) cnx.commit();
         if (returning.first) {
@@ -155,37 +173,29 @@ namespace {
             const fostlib::json &config,
             const fostgres::match &m,
             fostlib::http::server::request &req,
-            const fostlib::json &post_config,
+            const fostgres::method_plan &post_plan,
             const fostlib::json &body) {
-        fostlib::string relation =
-                fostlib::coerce<fostlib::string>(post_config["table"]);
-        fostlib::json col_config = post_config["columns"];
+        if (post_plan.table.empty()) {
+            throw fostlib::exceptions::not_implemented(
+                    __func__, "POST configuration must have a 'table'",
+                    post_plan.configuration);
+        }
+        fostlib::string relation = post_plan.table;
         fostlib::json values;
-        for (auto col_def = col_config.begin(); col_def != col_config.end();
-             ++col_def) {
-            const auto name = fostlib::coerce<fostlib::string>(col_def.key());
-            const auto data =
-                    fostgres::datum(name, *col_def, m.arguments, body, req);
+        for (const auto &column : post_plan.columns) {
+            const auto data = column.source(m.arguments, body, req);
             if (data) {
-                auto response = fostgres::schema_check(
-                        cnx, config, m, req, *col_def, data.value(),
-                        fostlib::jcursor{});
+                auto response =
+                        fostgres::schema_check(config, column, data.value());
                 if (response.second) { return response; }
-                fostlib::insert(values, name, data.value());
+                fostlib::insert(values, column.name, data.value());
             } else {
-                auto response = fostgres::schema_check(
-                        cnx, config, m, req, *col_def, fostlib::json(),
-                        fostlib::jcursor{});
+                auto response =
+                        fostgres::schema_check(config, column, fostlib::json());
                 if (response.second) { return response; }
             }
         }
-        const fostlib::json &ret_cols = post_config["returning"];
-        std::vector<fostlib::string> returning;
-        std::transform(
-                ret_cols.begin(), ret_cols.end(), std::back_inserter(returning),
-                [](const auto &s) {
-                    return fostlib::coerce<fostlib::string>(s);
-                });
+        std::vector<fostlib::string> returning = post_plan.returning;
         if (not returning.size()) { returning.emplace_back("*"); }
         auto result = fostgres::column_names(
                 cnx.insert(relation.shrink_to_fit(), values, returning));
@@ -197,18 +207,11 @@ namespace {
                  const fostlib::json &config,
                  const fostgres::match &m,
                  fostlib::http::server::request &req) {
-        fostlib::json body{fostlib::json::parse(fostlib::coerce<fostlib::string>(
-                fostlib::coerce<fostlib::utf8_string>(req.data()->data())))};
+        fostlib::json body{fostgres::request_json(req)};
         std::pair<boost::shared_ptr<fostlib::mime>, int> returning;
-        auto const post_config = m.configuration["POST"];
-        if (post_config.isobject()) {
-            returning = proc_post(cnx, config, m, req, post_config, body);
+        for (const auto &post_plan : m.plan().post) {
+            returning = proc_post(cnx, config, m, req, *post_plan, body);
             if (returning.second >= 400) return returning;
-        } else if (post_config.isarray()) {
-            for (const auto &cfg : post_config) {
-                returning = proc_post(cnx, config, m, req, cfg, body);
-                if (returning.second >= 400) return returning;
-            }
         }
         cnx.commit();
         return returning;
@@ -219,19 +222,17 @@ namespace {
                   const fostlib::json &config,
                   const fostgres::match &m,
                   fostlib::http::server::request &req) {
-        fostlib::json body{fostlib::json::parse(fostlib::coerce<fostlib::string>(
-                fostlib::coerce<fostlib::utf8_string>(req.data()->data())))};
-        auto error = fostgres::schema_check(
-                cnx, config, m, req, m.configuration["PATCH"], body,
-                fostlib::jcursor{});
+        fostlib::json body{fostgres::request_json(req)};
+        auto const patch_plan = m.plan().method("PATCH");
+        auto const &patch_config = patch_plan->configuration;
+        auto error = fostgres::schema_check(config, *patch_plan, body);
         if (error.first || error.second) return error;
 
-        fostlib::string relation = fostlib::coerce<fostlib::string>(
-                m.configuration["PATCH"]["table"]);
-        if (m.configuration["PATCH"].has_key("columns")) {
+        fostlib::string relation =
+                fostlib::coerce<fostlib::string>(patch_config["table"]);
+        if (patch_config.has_key("columns")) {
             auto [_1, _2, response, status] =
-                    fostgres::updater{m.configuration["PATCH"], cnx, m, req}
-                            .update(body);
+                    fostgres::updater{patch_plan, cnx, m, req}.update(body);
             if (status >= 400) { return std::make_pair(response, status); }
             cnx.commit();
         } else {
@@ -239,10 +240,10 @@ namespace {
                     "",
                     "PATCH configuration with 'keys' and 'attributes' is "
                     "deprecated. Use 'columns'")(
-                    "configuration", m.configuration["PATCH"]);
-            fostlib::json keys(calc_keys(m, m.configuration["PATCH"]["keys"]));
+                    "configuration", patch_config);
+            fostlib::json keys(calc_keys(m, patch_config["keys"]));
             fostlib::json values(
-                    calc_values(body, m.configuration["PATCH"]["attributes"]));
+                    calc_values(body, patch_config["attributes"]));
             cnx.update(relation.shrink_to_fit(), keys, values).commit();
         }
         return get(cnx, config, m, req);
@@ -255,9 +256,13 @@ namespace {
                 const fostgres::match &m,
                 fostlib::http::server::request &req) {
         auto get_result = get(cnx, config, m, req);
-        auto sql = fostlib::coerce<fostlib::string>(m.configuration["DELETE"]);
-        auto sp = cnx.procedure(fostlib::coerce<fostlib::utf8_string>(sql));
-        sp.exec(m.arguments);
+        auto const &sql = m.plan().del;
+        if (not sql) {
+            throw fostlib::exceptions::not_implemented(
+                    __func__, "There is no DELETE configuration",
+                    m.configuration);
+        }
+        fostgres::exec(cnx, m, f5::u8view{*sql}, m.arguments);
         cnx.commit();
         return get_result;
         ;
@@ -307,14 +312,15 @@ std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::response_object(
                 fostlib::mime::mime_headers(), "application/json"));
         return std::make_pair(response, 404);
     }
-    fostlib::json result;
-    auto record = *row;
-    for (std::size_t index{0}; index < record.size(); ++index) {
-        if (data.first[index].endswith("__tableoid")) continue;
-        const auto parts = fostlib::split(data.first[index], "__");
-        fostlib::jcursor pos;
-        for (const auto &p : parts) pos /= p;
-        fostlib::insert(result, pos, record[index]);
+    fostgres::column_layout const layout{data.first};
+    const auto &record = *row;
+    fostlib::string body;
+    if (pretty) {
+        body = fostlib::json::unparse(layout.object(record), true);
+    } else {
+        std::string encoded;
+        layout.encode(encoded, record);
+        body = fostlib::string{std::move(encoded)};
     }
     if (++row != data.second.end()) {
         // TODO Return proper error
@@ -322,7 +328,6 @@ std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::response_object(
                 __PRETTY_FUNCTION__, "Too many rows returned"};
     }
     boost::shared_ptr<fostlib::mime> response(new fostlib::text_body(
-            fostlib::json::unparse(result, pretty),
-            fostlib::mime::mime_headers(), "application/json"));
+            body, fostlib::mime::mime_headers(), "application/json"));
     return std::make_pair(response, 200);
 }
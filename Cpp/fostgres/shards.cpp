@@ -0,0 +1,188 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "shards.hpp"
+
+#include <fostgres/plan.hpp>
+
+#include <fost/insert>
+
+#include <algorithm>
+#include <charconv>
+
+
+namespace {
+    /// The number of points each server has on the hash ring. More points
+    /// spread the keys more evenly
+    constexpr std::size_t c_ring_points = 128;
+
+    /// The hash has to be the same for every process that uses the view,
+    /// so `std::hash` can't be used. This is FNV-1a followed by a final mix
+    /// to spread similar keys over the ring.
+    std::uint64_t hash(std::string_view bytes) {
+        std::uint64_t h = 0xcbf29ce484222325u;
+        for (unsigned char const c : bytes) {
+            h ^= c;
+            h *= 0x100000001b3u;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdu;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53u;
+        h ^= h >> 33;
+        return h;
+    }
+
+    std::string_view bytes_of(f5::u8view s) { return {s.data(), s.bytes()}; }
+
+    /// The server's connection settings. Its `name` is only used to place
+    /// it on the hash ring
+    fostlib::json settings(const fostlib::json &server) {
+        fostlib::json s{fostlib::json::object_t{}};
+        for (auto const &item : server.object()) {
+            if (item.first != "name") {
+                fostlib::insert(s, item.first, item.second);
+            }
+        }
+        return s;
+    }
+}
+
+
+fostlib::json fostgres::server_configuration(
+        const fostlib::json &configuration, const fostlib::json &server) {
+    fostlib::json config{configuration};
+    for (auto const &item : server.object()) {
+        fostlib::jcursor const key{item.first};
+        if (config.has_key(item.first)) {
+            key.replace(config, item.second);
+        } else {
+            key.insert(config, item.second);
+        }
+    }
+    return config;
+}
+
+
+/**
+ * ## `fostgres::unknown_shard`
+ */
+
+
+fostgres::unknown_shard::unknown_shard(f5::u8view key) {
+    fostlib::insert(data(), "key", fostlib::string{key});
+}
+
+
+const wchar_t *const fostgres::unknown_shard::message() const noexcept {
+    return L"No shard server takes the shard key";
+}
+
+
+/**
+ * ## `fostgres::shard_map`
+ */
+
+
+fostgres::shard_map::shard_map(const fostlib::json &shards) {
+    if (shards["servers"].isarray()) {
+        for (auto const &server : shards["servers"]) {
+            /// The ring points only depend on the name, so the server's
+            /// other settings can change without moving any keys
+            auto const name =
+                    fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                            server["name"]);
+            if (not name) {
+                throw fostlib::exceptions::not_implemented(
+                        __PRETTY_FUNCTION__,
+                        "Each shard server must have a 'name'", server);
+            }
+            auto const prefix = std::string{bytes_of(*name)} + '#';
+            for (std::size_t point{}; point < c_ring_points; ++point) {
+                ring.emplace_back(
+                        hash(prefix + std::to_string(point)), servers.size());
+            }
+            servers.push_back(settings(server));
+        }
+        std::sort(ring.begin(), ring.end());
+    } else if (shards["ranges"].isarray()) {
+        for (auto const &r : shards["ranges"]) {
+            range item{{}, {}, servers.size()};
+            auto const &below = r["below"];
+            if (below.isnull()) {
+                // A range without a bound takes all of the keys left
+            } else if (auto const number = below.get<int64_t>(); number) {
+                item.number = *number;
+            } else if (auto const text =
+                               fostlib::coerce<fostlib::nullable<f5::u8view>>(
+                                       below);
+                       text) {
+                item.text = std::string{bytes_of(*text)};
+            } else {
+                throw fostlib::exceptions::not_implemented(
+                        __PRETTY_FUNCTION__,
+                        "A shard range's 'below' must be a whole number or "
+                        "a string",
+                        r);
+            }
+            ranges.push_back(std::move(item));
+            servers.push_back(settings(r["server"]));
+        }
+    }
+    if (servers.empty()) {
+        throw fostlib::exceptions::not_implemented(
+                __PRETTY_FUNCTION__,
+                "The shards must have either 'servers' or 'ranges'", shards);
+    }
+}
+
+
+const fostlib::json &fostgres::shard_map::server(f5::u8view key) const {
+    if (ring.size()) {
+        auto const point = hash(bytes_of(key));
+        auto pos = std::lower_bound(
+                ring.begin(), ring.end(),
+                std::make_pair(point, std::size_t{}));
+        if (pos == ring.end()) { pos = ring.begin(); }
+        return servers[pos->second];
+    }
+    for (auto const &r : ranges) {
+        if (r.number) {
+            int64_t number{};
+            auto const k = bytes_of(key);
+            auto const [end, error] =
+                    std::from_chars(k.data(), k.data() + k.size(), number);
+            if (error != std::errc{} || end != k.data() + k.size()) {
+                throw unknown_shard{key};
+            }
+            if (number < *r.number) { return servers[r.server]; }
+        } else if (r.text) {
+            if (bytes_of(key) < *r.text) { return servers[r.server]; }
+        } else {
+            return servers[r.server];
+        }
+    }
+    throw unknown_shard{key};
+}
+
+
+fostlib::json fostgres::shard_configuration(
+        const fostlib::json &configuration,
+        const shard_map *const shards,
+        const match &m) {
+    auto const argument = m.plan().shard;
+    if (not argument || not shards) {
+        return configuration;
+    } else if (argument > m.arguments.size()) {
+        throw fostlib::exceptions::not_implemented(
+                __PRETTY_FUNCTION__,
+                "The shard key argument isn't in the path", m.configuration);
+    }
+    return server_configuration(
+            configuration, shards->server(m.arguments[argument - 1]));
+}
@@ -0,0 +1,75 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fostgres/matcher.hpp>
+
+#include <fost/core>
+
+#include <cstdint>
+#include <optional>
+
+
+namespace fostgres {
+
+
+    /// The view's connection configuration with the server's settings
+    /// (`host`, `dbname` etc.) replacing its own
+    fostlib::json server_configuration(
+            const fostlib::json &configuration, const fostlib::json &server);
+
+
+    /// Thrown when none of the shard servers takes the request's shard
+    /// key. The `fostgres.sql` view responds with a 404.
+    class unknown_shard : public fostlib::exceptions::exception {
+      public:
+        explicit unknown_shard(f5::u8view key);
+
+      protected:
+        const wchar_t *const message() const noexcept override;
+    };
+
+
+    /// Picks the server for a shard key from a view's `shards`. The
+    /// servers are either placed on a consistent hash ring, or given
+    /// ranges of keys.
+    class shard_map {
+      public:
+        explicit shard_map(const fostlib::json &shards);
+
+        /// The server settings for the key. Throws `unknown_shard` if
+        /// there isn't one.
+        const fostlib::json &server(f5::u8view key) const;
+
+      private:
+        std::vector<fostlib::json> servers;
+        /// Points on the hash ring, in order, and their server
+        std::vector<std::pair<std::uint64_t, std::size_t>> ring;
+        /// Keys below the bound go to the server. A range with no bound
+        /// takes every key
+        struct range {
+            std::optional<int64_t> number;
+            std::optional<std::string> text;
+            std::size_t server;
+        };
+        std::vector<range> ranges;
+    };
+
+
+    /// The connection configuration for the shard that the request's
+    /// shard key belongs to. Views without `shards` and end points
+    /// without `shard` use the view's configuration.
+    fostlib::json shard_configuration(
+            const fostlib::json &configuration,
+            const shard_map *shards,
+            const match &);
+
+
+}
@@ -0,0 +1,128 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "shards.hpp"
+
+#include <fost/insert>
+#include <fost/push_back>
+#include <fost/test>
+
+
+FSL_TEST_SUITE(shards);
+
+
+namespace {
+    fostlib::json server(f5::u8view host) {
+        fostlib::json s;
+        fostlib::insert(s, "host", host);
+        return s;
+    }
+    fostlib::json named(f5::u8view name, f5::u8view host) {
+        auto s = server(host);
+        fostlib::insert(s, "name", name);
+        return s;
+    }
+}
+
+
+FSL_TEST_FUNCTION(server_configuration) {
+    fostlib::json config;
+    fostlib::insert(config, "host", "primary");
+    fostlib::insert(config, "dbname", "films");
+    auto const c = fostgres::server_configuration(config, server("db2"));
+    FSL_CHECK_EQ(c["host"], fostlib::json{"db2"});
+    FSL_CHECK_EQ(c["dbname"], fostlib::json{"films"});
+}
+
+
+FSL_TEST_FUNCTION(hash_ring) {
+    fostlib::json two, three;
+    fostlib::push_back(two, "servers", named("db1", "db1"));
+    fostlib::push_back(two, "servers", named("db2", "db2"));
+    three = two;
+    fostlib::push_back(three, "servers", named("db3", "db3"));
+
+    fostgres::shard_map const before{two}, after{three};
+    std::size_t moved{}, on_db1{};
+    for (std::size_t key{}; key < 1000; ++key) {
+        auto const k = std::to_string(key);
+        auto const &b = before.server(f5::u8view{k});
+        auto const &a = after.server(f5::u8view{k});
+        if (not(b == a)) {
+            ++moved;
+            /// Keys only move to the new server
+            FSL_CHECK_EQ(a, server("db3"));
+        }
+        if (b == server("db1")) { ++on_db1; }
+    }
+    FSL_CHECK(moved > 100 && moved < 600);
+    FSL_CHECK(on_db1 > 250 && on_db1 < 750);
+}
+
+
+FSL_TEST_FUNCTION(hash_ring_uses_names) {
+    fostlib::json before, after;
+    fostlib::push_back(before, "servers", named("a", "db1"));
+    fostlib::push_back(before, "servers", named("b", "db2"));
+    fostlib::push_back(after, "servers", named("a", "db1.example.com"));
+    fostlib::push_back(after, "servers", named("b", "db2.example.com"));
+
+    fostgres::shard_map const b{before}, a{after};
+    for (std::size_t key{}; key < 100; ++key) {
+        auto const k = std::to_string(key);
+        /// Moving a server to a new host doesn't move its keys, and the
+        /// name isn't passed on as a connection setting
+        if (b.server(f5::u8view{k}) == server("db1")) {
+            FSL_CHECK_EQ(a.server(f5::u8view{k}), server("db1.example.com"));
+        } else {
+            FSL_CHECK_EQ(b.server(f5::u8view{k}), server("db2"));
+            FSL_CHECK_EQ(a.server(f5::u8view{k}), server("db2.example.com"));
+        }
+    }
+
+    fostlib::json unnamed;
+    fostlib::push_back(unnamed, "servers", server("db1"));
+    FSL_CHECK_EXCEPTION(
+            fostgres::shard_map{unnamed},
+            fostlib::exceptions::not_implemented &);
+}
+
+
+FSL_TEST_FUNCTION(ranges) {
+    fostlib::json shards, low, high;
+    fostlib::insert(low, "below", 1000);
+    fostlib::insert(low, "server", server("db1"));
+    fostlib::insert(high, "server", server("db2"));
+    fostlib::push_back(shards, "ranges", low);
+    fostlib::push_back(shards, "ranges", high);
+
+    fostgres::shard_map const map{shards};
+    FSL_CHECK_EQ(map.server("999"), server("db1"));
+    FSL_CHECK_EQ(map.server("1000"), server("db2"));
+    FSL_CHECK_EXCEPTION(map.server("abc"), fostgres::unknown_shard &);
+
+    fostlib::json bounded;
+    fostlib::push_back(bounded, "ranges", low);
+    FSL_CHECK_EXCEPTION(
+            fostgres::shard_map{bounded}.server("1000"),
+            fostgres::unknown_shard &);
+
+    fostlib::json bad, wrong;
+    fostlib::insert(wrong, "below", true);
+    fostlib::insert(wrong, "server", server("db1"));
+    fostlib::push_back(bad, "ranges", wrong);
+    FSL_CHECK_EXCEPTION(
+            fostgres::shard_map{bad}, fostlib::exceptions::not_implemented &);
+}
+
+
+FSL_TEST_FUNCTION(no_servers) {
+    FSL_CHECK_EXCEPTION(
+            fostgres::shard_map{fostlib::json::object_t()},
+            fostlib::exceptions::not_implemented &);
+}
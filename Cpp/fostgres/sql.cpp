@@ -6,13 +6,16 @@
  */
 
 
-#include <fost/log>
+#include "log.hpp"
+
 #include <fostgres/callback.hpp>
 #include <fostgres/datum.hpp>
 #include <fostgres/db.hpp>
 #include <fostgres/fostgres.hpp>
 #include <fostgres/matcher.hpp>
+#include <fostgres/plan.hpp>
 #include <fostgres/sql.hpp>
+#include <fostgres/statements.hpp>
 
 #include <mutex>
 
@@ -128,13 +131,19 @@ fostlib::pg::connection fostgres::connection(
         const fostlib::nullable<fostlib::string> &zi,
         const fostlib::http::server::request &req) {
     auto cnx = fostgres::connection(config, zi);
+    connection_established(cnx, req);
+    return cnx;
+}
 
-    std::unique_lock<std::mutex> lock{g_cb_mut};
-    for (const auto *const cb : g_callbacks()) (*cb)(cnx, req);
 
+void fostgres::connection_established(
+        fostlib::pg::connection &cnx,
+        const fostlib::http::server::request &req) {
+    {
+        std::unique_lock<std::mutex> lock{g_cb_mut};
+        for (const auto *const cb : g_callbacks()) (*cb)(cnx, req);
+    }
     cnx.set_session("fostgres.source_addr", req.remote_address().name());
-
-    return cnx;
 }
 
 
@@ -153,9 +162,10 @@ fostlib::pg::connection fostgres::connection(
 
 std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> fostgres::sql(
         fostlib::pg::connection &cnx, const fostlib::string &cmd) {
-    auto logger = fostlib::log::debug(c_fostgres);
-    logger("",
-           "Executing SQL command")("dsn", cnx.configuration())("command", cmd);
+    log_debug([&](auto &&logger) {
+        logger("", "Executing SQL command")("dsn", cnx.configuration())(
+                "command", cmd);
+    });
 
     /// Execute the SQL we've been given
     auto rs = cnx.exec(fostlib::coerce<fostlib::utf8_string>(cmd));
@@ -166,14 +176,18 @@ std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> fostgres::sql(
 
 
 namespace {
-    const auto sql_impl = [](auto &cnx, const auto &cmd, const auto &args) {
-        auto logger = fostlib::log::debug(fostgres::c_fostgres);
-        logger("", "Executing SQL command")("dsn", cnx.configuration())(
-                "command", cmd)("args", args);
+    const auto sql_impl = [](auto &cnx,
+                             const fostgres::match *m,
+                             const auto &cmd,
+                             const auto &args) {
+        fostgres::log_debug([&](auto &&logger) {
+            logger("", "Executing SQL command")("dsn", cnx.configuration())(
+                    "command", cmd)("args", args);
+        });
 
         /// Execute the SQL we've been given
-        auto sp = cnx.procedure(fostlib::coerce<fostlib::utf8_string>(cmd));
-        auto rs = sp.exec(args);
+        auto rs = m ? fostgres::exec(cnx, *m, f5::u8view{cmd}, args)
+                    : fostgres::exec(cnx, f5::u8view{cmd}, args);
 
         return fostgres::column_names(std::move(rs));
     };
@@ -182,13 +196,27 @@ std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> fostgres::sql(
         fostlib::pg::connection &cnx,
         const fostlib::string &cmd,
         const std::vector<fostlib::string> &args) {
-    return sql_impl(cnx, cmd, args);
+    return sql_impl(cnx, nullptr, cmd, args);
 }
 std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> fostgres::sql(
         fostlib::pg::connection &cnx,
         const fostlib::string &cmd,
         const std::vector<fostlib::json> &args) {
-    return sql_impl(cnx, cmd, args);
+    return sql_impl(cnx, nullptr, cmd, args);
+}
+std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> fostgres::sql(
+        fostlib::pg::connection &cnx,
+        const match &m,
+        const fostlib::string &cmd,
+        const std::vector<fostlib::string> &args) {
+    return sql_impl(cnx, &m, cmd, args);
+}
+std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> fostgres::sql(
+        fostlib::pg::connection &cnx,
+        const match &m,
+        const fostlib::string &cmd,
+        const std::vector<fostlib::json> &args) {
+    return sql_impl(cnx, &m, cmd, args);
 }
 
 
@@ -227,13 +255,73 @@ std::pair<std::vector<fostlib::string>, fostlib::pg::recordset>
                     select);
         }
         return fostgres::sql(
-                cnx, fostlib::coerce<fostlib::string>(select["command"]),
+                cnx, m, fostlib::coerce<fostlib::string>(select["command"]),
                 arguments);
     } else {
         return m.arguments.size()
                 ? fostgres::sql(
-                        cnx, fostlib::coerce<fostlib::string>(select),
+                        cnx, m, fostlib::coerce<fostlib::string>(select),
                         m.arguments)
                 : fostgres::sql(cnx, fostlib::coerce<fostlib::string>(select));
     }
 }
+namespace {
+    std::vector<fostlib::json> select_arguments(
+            const std::vector<fostlib::json> &sources,
+            const fostgres::match &m,
+            const fostlib::http::server::request &req) {
+        std::vector<fostlib::json> arguments;
+        arguments.reserve(sources.size());
+        for (const auto &arg : sources) {
+            try {
+                arguments.push_back(
+                        fostgres::datum(arg, m.arguments, fostlib::json(), req)
+                                .value_or(fostlib::json()));
+            } catch (fostlib::exceptions::exception &e) {
+                insert(e.data(), "datum", arg);
+                throw;
+            }
+        }
+        return arguments;
+    }
+}
+std::pair<fostlib::string, std::vector<fostlib::json>>
+        fostgres::select_command(
+                const select_plan &select,
+                const fostgres::match &m,
+                const fostlib::http::server::request &req) {
+    if (select.arguments) {
+        return {select.command, select_arguments(*select.arguments, m, req)};
+    } else if (select.command.empty()) {
+        throw fostlib::exceptions::not_implemented(
+                __func__,
+                "SELECT configuration must be SQL or an object with "
+                "'command' and 'arguments' keys",
+                select.configuration);
+    } else {
+        std::vector<fostlib::json> arguments;
+        arguments.reserve(m.arguments.size());
+        for (const auto &arg : m.arguments) { arguments.emplace_back(arg); }
+        return {select.command, std::move(arguments)};
+    }
+}
+std::pair<std::vector<fostlib::string>, fostlib::pg::recordset>
+        fostgres::select_data(
+                fostlib::pg::connection &cnx,
+                const select_plan &select,
+                const fostgres::match &m,
+                const fostlib::http::server::request &req) {
+    if (select.arguments) {
+        return fostgres::sql(
+                cnx, m, select.command,
+                select_arguments(*select.arguments, m, req));
+    } else if (select.command.empty()) {
+        /// The configuration couldn't be compiled, so use the full version
+        /// to report what is wrong with it
+        return select_data(cnx, select.configuration, m, req);
+    } else {
+        return m.arguments.size()
+                ? fostgres::sql(cnx, m, select.command, m.arguments)
+                : fostgres::sql(cnx, select.command);
+    }
+}
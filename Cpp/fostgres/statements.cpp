@@ -0,0 +1,174 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fostgres/fostgres.hpp>
+#include <fostgres/matcher.hpp>
+#include <fostgres/pool.hpp>
+#include <fostgres/statements.hpp>
+
+#include <fost/insert>
+#include <fost/log>
+
+#include <pqxx/except>
+
+
+namespace {
+
+
+    std::atomic<int64_t> g_hits{}, g_misses{}, g_evictions{};
+
+
+}
+
+
+/**
+ * ## `fostgres::statement_cache`
+ */
+
+
+fostgres::statement_cache::statement_cache(std::size_t c, generation_type g)
+: capacity{std::max<std::size_t>(c, 1u)},
+  generation{std::move(g)},
+  seen{generation ? generation->load() : 0u} {}
+
+
+fostgres::statement_cache::lru_type::iterator fostgres::statement_cache::lookup(
+        fostlib::pg::connection &cnx, f5::u8view sql) {
+    if (generation && *generation != seen) {
+        clear();
+        seen = *generation;
+    }
+    const std::string_view key{sql.data(), sql.bytes()};
+    if (auto found = statements.find(key); found != statements.end()) {
+        ++g_hits;
+        lru.splice(lru.begin(), lru, found->second);
+        return found->second;
+    }
+    ++g_misses;
+    auto procedure = cnx.procedure(fostlib::utf8_string{sql});
+    lru.push_front(entry{std::string{key}, std::move(procedure)});
+    statements.emplace(lru.front().sql, lru.begin());
+    while (lru.size() > capacity) {
+        ++g_evictions;
+        statements.erase(lru.back().sql);
+        lru.pop_back();
+    }
+    return lru.begin();
+}
+
+
+template<typename Args>
+fostlib::pg::recordset fostgres::statement_cache::exec_impl(
+        fostlib::pg::connection &cnx, f5::u8view sql, const Args &args) {
+    auto pos = lookup(cnx, sql);
+    try {
+        return pos->procedure.exec(args);
+    } catch (const pqxx::sql_error &e) {
+        if (stale(e)) {
+            fostlib::log::info(fostgres::c_fostgres)(
+                    "", "Prepared statements are stale, clearing cache")(
+                    "sqlstate", e.sqlstate())("statements", size());
+            clear();
+            if (generation) { seen = ++*generation; }
+        }
+        throw;
+    }
+}
+
+
+fostlib::pg::recordset fostgres::statement_cache::exec(
+        fostlib::pg::connection &cnx,
+        f5::u8view sql,
+        const std::vector<fostlib::string> &args) {
+    return exec_impl(cnx, sql, args);
+}
+fostlib::pg::recordset fostgres::statement_cache::exec(
+        fostlib::pg::connection &cnx,
+        f5::u8view sql,
+        const std::vector<fostlib::json> &args) {
+    return exec_impl(cnx, sql, args);
+}
+
+
+void fostgres::statement_cache::clear() {
+    statements.clear();
+    lru.clear();
+}
+
+
+fostlib::json fostgres::statement_cache::statistics() {
+    fostlib::json stats;
+    fostlib::insert(stats, "hits", g_hits.load());
+    fostlib::insert(stats, "misses", g_misses.load());
+    fostlib::insert(stats, "evictions", g_evictions.load());
+    return stats;
+}
+
+
+bool fostgres::statement_cache::stale(const std::exception &e) {
+    if (auto const *sql = dynamic_cast<const pqxx::sql_error *>(&e); sql) {
+        const std::string state{sql->sqlstate()};
+        return state == "26000" /* invalid_sql_statement_name */
+                || state == "0A000" /* cached plan must not change type */;
+    } else {
+        return false;
+    }
+}
+
+
+/**
+ * ## `fostgres::exec`
+ */
+
+
+namespace {
+    template<typename Args>
+    fostlib::pg::recordset cached_exec(
+            fostlib::pg::connection &cnx,
+            fostgres::statement_cache *cache,
+            f5::u8view sql,
+            const Args &args) {
+        if (cache) {
+            return cache->exec(cnx, sql, args);
+        } else {
+            auto sp = cnx.procedure(fostlib::utf8_string{sql});
+            return sp.exec(args);
+        }
+    }
+    fostgres::statement_cache *
+            cache_for(fostlib::pg::connection &cnx, const fostgres::match &m) {
+        auto *lease = m.lease_for(cnx);
+        return lease ? lease->statements_for(cnx) : nullptr;
+    }
+}
+fostlib::pg::recordset fostgres::exec(
+        fostlib::pg::connection &cnx,
+        f5::u8view sql,
+        const std::vector<fostlib::string> &args) {
+    return cached_exec(cnx, nullptr, sql, args);
+}
+fostlib::pg::recordset fostgres::exec(
+        fostlib::pg::connection &cnx,
+        f5::u8view sql,
+        const std::vector<fostlib::json> &args) {
+    return cached_exec(cnx, nullptr, sql, args);
+}
+fostlib::pg::recordset fostgres::exec(
+        fostlib::pg::connection &cnx,
+        const match &m,
+        f5::u8view sql,
+        const std::vector<fostlib::string> &args) {
+    return cached_exec(cnx, cache_for(cnx, m), sql, args);
+}
+fostlib::pg::recordset fostgres::exec(
+        fostlib::pg::connection &cnx,
+        const match &m,
+        f5::u8view sql,
+        const std::vector<fostlib::json> &args) {
+    return cached_exec(cnx, cache_for(cnx, m), sql, args);
+}
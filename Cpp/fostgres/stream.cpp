@@ -0,0 +1,147 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include "log.hpp"
+#include "stream.hpp"
+
+#include <fostgres/fostgres.hpp>
+#include <fostgres/plan.hpp>
+#include <fostgres/sql.hpp>
+#include <fostgres/statements.hpp>
+
+
+namespace {
+    /// Chunks are sent once they reach this size
+    constexpr std::size_t c_chunk_size = 48 * 1024;
+
+    /// A lease only ever streams one cursor at a time, and ending the
+    /// transaction closes it, so the name can be reused. Keeping it the
+    /// same lets the `DECLARE` use the lease's statement cache
+    constexpr char const *c_cursor = "fg_stream";
+}
+
+
+/**
+ * ## `fostgres::row_source`
+ */
+
+
+fostgres::row_source::row_source(
+        fostlib::pg::recordset &&r,
+        std::unique_ptr<pooled_connection> l,
+        fostlib::utf8_string f)
+: rs(std::move(r)), lease(std::move(l)), fetch(std::move(f)) {}
+
+
+bool fostgres::row_source::more() {
+    if (not iter) {
+        iter = rs->begin();
+        end = rs->end();
+    }
+    if (*iter != *end) {
+        return true;
+    } else if (not lease) {
+        return false;
+    }
+    rs.reset();
+    rs.emplace((*lease)->exec(fetch));
+    iter = rs->begin();
+    end = rs->end();
+    if (*iter == *end) {
+        /// Closing the transaction also closes the cursor
+        lease->release();
+        lease.reset();
+        return false;
+    }
+    return true;
+}
+
+
+std::pair<std::vector<fostlib::string>, fostgres::row_source>
+        fostgres::select_rows(
+                fostlib::pg::connection &cnx,
+                const match &m,
+                const fostlib::string &command,
+                const std::vector<fostlib::json> &arguments) {
+    if (auto const rows = m.plan().stream; rows) {
+        if (m.lease_for(cnx)) {
+            log_debug([&](auto &&logger) {
+                logger("", "Streaming GET")("command", command)(
+                        "args", arguments)("rows", rows);
+            });
+            std::string declare{"DECLARE "};
+            declare += c_cursor;
+            declare += " NO SCROLL CURSOR FOR ";
+            declare += static_cast<std::string_view>(command);
+            exec(cnx, m, f5::u8view{declare}, arguments);
+            /// The rows are read after the view has returned, so the body
+            /// takes the lease. The connection itself stays where it is so
+            /// `cnx` remains valid for the caller
+            auto lease = m.take_lease(cnx);
+            fostlib::utf8_string fetch{
+                    "FETCH FORWARD " + std::to_string(rows) + " FROM "
+                    + c_cursor};
+            auto data = column_names((*lease)->exec(fetch));
+            return {std::move(data.first),
+                    row_source{
+                            std::move(data.second), std::move(lease),
+                            std::move(fetch)}};
+        }
+    }
+    auto data = sql(cnx, m, command, arguments);
+    return {std::move(data.first), row_source{std::move(data.second)}};
+}
+
+
+/**
+ * ## `fostgres::chunked_iterator`
+ */
+
+
+fostlib::const_memory_block fostgres::chunked_iterator::operator()() {
+    current.clear();
+    while (not finished && current.size() < c_chunk_size) {
+        finished = not fill(current);
+    }
+    if (current.empty()) {
+        return fostlib::const_memory_block();
+    } else {
+        return fostlib::const_memory_block(
+                current.data(), current.data() + current.size());
+    }
+}
+
+
+/**
+ * ## `fostgres::chunked_mime`
+ */
+
+
+fostgres::chunked_mime::chunked_mime(f5::u8view content_type)
+: mime(fostlib::mime::mime_headers(), content_type) {}
+
+
+std::unique_ptr<fostlib::mime::iterator_implementation>
+        fostgres::chunked_mime::iterator() const {
+    if (done) {
+        throw fostlib::exceptions::not_implemented(
+                __func__, "The data can only be iterated over once");
+    }
+    done = true;
+    return body();
+}
+
+
+bool fostgres::chunked_mime::boundary_is_ok(const fostlib::string &) const {
+    throw fostlib::exceptions::not_implemented(__func__);
+}
+
+
+std::ostream &fostgres::chunked_mime::print_on(std::ostream &) const {
+    throw fostlib::exceptions::not_implemented(__func__);
+}
@@ -0,0 +1,106 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fostgres/matcher.hpp>
+#include <fostgres/pool.hpp>
+
+#include <fost/http.server.hpp>
+
+#include <optional>
+#include <string>
+
+
+namespace fostgres {
+
+
+    /**
+     * ## Streamed responses
+     *
+     * Responders that send many rows build their body a chunk at a time
+     * as it is sent. The rows either come from a recordset that has
+     * already been read, or from a cursor that is fetched from a block at
+     * a time.
+     */
+
+
+    /// The rows of a `SELECT`
+    class row_source {
+      public:
+        explicit row_source(
+                fostlib::pg::recordset &&,
+                std::unique_ptr<pooled_connection> lease = nullptr,
+                fostlib::utf8_string fetch = {});
+
+        /// Returns true if there is a current row, fetching the next block
+        /// from the cursor if needed
+        bool more();
+        /// The current row. Only valid after `more` has returned true
+        decltype(auto) row() const { return **iter; }
+        /// Move on to the next row
+        void next() { ++*iter; }
+
+      private:
+        std::optional<fostlib::pg::recordset> rs;
+        /// The iterators are only made once the rows are being read so the
+        /// source can be moved around before then
+        std::optional<fostlib::pg::recordset::const_iterator> iter, end;
+        /// When streaming the rows are fetched from a cursor on this
+        /// connection as the body is sent
+        std::unique_ptr<pooled_connection> lease;
+        fostlib::utf8_string fetch;
+    };
+
+
+    /// Run the `SELECT` and return the column names and the rows. When
+    /// the end point has `stream` set and the match carries the lease for
+    /// the connection the rows come from a cursor, and the lease is taken
+    /// from the match (see `match::take_lease`) by the returned rows.
+    std::pair<std::vector<fostlib::string>, row_source> select_rows(
+            fostlib::pg::connection &,
+            const match &,
+            const fostlib::string &command,
+            const std::vector<fostlib::json> &arguments);
+
+
+    /// A body that is made a chunk at a time. `fill` appends to the
+    /// buffer and returns false once there is nothing more to add.
+    class chunked_iterator : public fostlib::mime::iterator_implementation {
+      public:
+        fostlib::const_memory_block operator()() final;
+
+      protected:
+        virtual bool fill(std::string &) = 0;
+
+      private:
+        std::string current;
+        bool finished = false;
+    };
+
+
+    /// A response body that can only be sent once
+    class chunked_mime : public fostlib::mime {
+      public:
+        chunked_mime(f5::u8view content_type);
+
+        std::unique_ptr<iterator_implementation> iterator() const final;
+        bool boundary_is_ok(const fostlib::string &) const final;
+        std::ostream &print_on(std::ostream &) const final;
+
+      protected:
+        /// Make the iterator for the body. Called at most once
+        virtual std::unique_ptr<chunked_iterator> body() const = 0;
+
+      private:
+        mutable bool done = false;
+    };
+
+
+}
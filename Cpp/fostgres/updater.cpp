@@ -6,11 +6,17 @@
  */
 
 
+#include "log.hpp"
 #include "updater.hpp"
 
 #include <fostgres/datum.hpp>
+#include <fostgres/fostgres.hpp>
+#include <fostgres/statements.hpp>
 #include <f5/json/schema.cache.hpp>
 #include <fost/insert>
+#include <fost/push_back>
+
+#include <algorithm>
 
 
 /**
@@ -23,78 +29,126 @@ fostgres::updater::updater(
         fostlib::pg::connection &cnx,
         const fostgres::match &m,
         fostlib::http::server::request &req)
-: relation(fostlib::coerce<fostlib::string>(mconf["table"])),
+: updater(std::make_shared<const method_plan>(std::move(mconf)), cnx, m, req) {}
+
+
+fostgres::updater::updater(
+        std::shared_ptr<const method_plan> p,
+        fostlib::pg::connection &cnx,
+        const fostgres::match &m,
+        fostlib::http::server::request &req)
+: relation(p->table),
   deduced_action(action::do_default),
+  plan(std::move(p)),
   config(m.configuration),
-  method_config(mconf),
-  col_config(mconf["columns"]),
+  method_config(plan->configuration),
+  returning_cols(plan->returning),
   cnx(cnx),
   m(m),
   req(req) {
-    if (mconf.has_key("returning")) {
-        const fostlib::json &ret_cols = mconf["returning"];
-        std::transform(
-                ret_cols.begin(), ret_cols.end(),
-                std::back_inserter(returning_cols), [](const auto &s) {
-                    return fostlib::coerce<fostlib::string>(s);
-                });
+    if (relation.empty()) {
+        throw fostlib::exceptions::not_implemented(
+                __PRETTY_FUNCTION__, "The configuration must have a 'table'",
+                method_config);
     }
 }
 
 
-std::pair<fostlib::json, fostlib::json>
-        fostgres::updater::data(const fostlib::json &body) {
-    deduced_action = action::do_default;
-    fostlib::json keys, values;
-    for (const auto &col_def : col_config.object()) {
-        const auto &key = col_def.first;
-        auto data =
-                fostgres::datum(key, col_def.second, m.arguments, body, req);
-        if (col_def.second["key"].get(false)) {
-            /// Key column. We must have data for this.
-            if (data) {
-                fostlib::insert(keys, key, data.value());
+namespace {
+    fostgres::updater::intermediate_data split(
+            const fostgres::method_plan &plan,
+            const std::vector<fostlib::string> &arguments,
+            const fostlib::json &body,
+            const fostlib::http::server::request *req,
+            fostgres::updater::action &deduced_action) {
+        deduced_action = fostgres::updater::action::do_default;
+        fostlib::json keys, values;
+        for (const auto &column : plan.columns) {
+            const auto &key = column.name;
+            auto data = req ? column.source(arguments, body, *req)
+                            : column.source(arguments, body);
+            if (column.key) {
+                /// Key column. We must have data for this.
+                if (data) {
+                    fostlib::insert(keys, key, data.value());
+                } else {
+                    /// TODO Should return a 422 response instead
+                    throw fostlib::exceptions::not_implemented{
+                            __PRETTY_FUNCTION__,
+                            "Key column doesn't have a value", key};
+                }
+            } else if (data) {
+                /// Value column with data
+                fostlib::insert(values, key, data.value());
             } else {
-                /// TODO Should return a 422 response instead
-                throw fostlib::exceptions::not_implemented{
-                        __PRETTY_FUNCTION__, "Key column doesn't have a value",
-                        key};
-            }
-        } else if (data) {
-            /// Value column with data
-            fostlib::insert(values, key, data.value());
-        } else {
-            /// There is no data for this column. We will skip it in the
-            /// update/insert.
-            if (col_def.second["insert"] == "required") {
-                /// Because there is no value for this column, and it
-                /// is marked as required for insert we suggest a forced
-                /// update for this.
-                deduced_action = action::updateable;
+                /// There is no data for this column. We will skip it in the
+                /// update/insert.
+                if (column.insert_required) {
+                    /// Because there is no value for this column, and it
+                    /// is marked as required for insert we suggest a forced
+                    /// update for this.
+                    deduced_action = fostgres::updater::action::updateable;
+                }
             }
         }
+        return std::make_pair(keys, values);
     }
-    return std::make_pair(keys, values);
 }
 
 
-std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::updater::insert(
-        fostlib::json const &body_row,
-        fostgres::updater::intermediate_data d,
-        std::optional<std::size_t> row) {
-    auto const [sbody, sstatus] =
-            schema_check(cnx, config, m, req, method_config, body_row, {});
+std::pair<fostlib::json, fostlib::json>
+        fostgres::updater::data(const fostlib::json &body) {
+    return split(*plan, m.arguments, body, &req, deduced_action);
+}
+std::pair<fostlib::json, fostlib::json> fostgres::updater::data(
+        const method_plan &plan,
+        const std::vector<fostlib::string> &arguments,
+        const fostlib::json &body,
+        action &deduced) {
+    return split(plan, arguments, body, nullptr, deduced);
+}
+
+
+std::pair<boost::shared_ptr<fostlib::mime>, int>
+        fostgres::updater::check_insert(
+                fostlib::json const &body_row,
+                const fostgres::updater::intermediate_data &d,
+                std::optional<std::size_t> row) {
+    return check_insert(config, *plan, body_row, d, row);
+}
+std::pair<boost::shared_ptr<fostlib::mime>, int>
+        fostgres::updater::check_insert(
+                const fostlib::json &config,
+                const method_plan &plan,
+                fostlib::json const &body_row,
+                const fostgres::updater::intermediate_data &d,
+                std::optional<std::size_t> row) {
+    auto const [sbody, sstatus] = schema_check(config, plan, body_row);
     if (sbody || sstatus) return {sbody, sstatus};
-    for (const auto &col_def : col_config.object()) {
-        auto const instance =
-                (col_def.second["key"].get(false) ? d.first
-                                                  : d.second)[col_def.first];
+    for (const auto &column : plan.columns) {
+        auto const instance = (column.key ? d.first : d.second)[column.name];
         auto error = schema_check(
-                cnx, config, m, req, col_def.second, instance,
+                config, column, instance,
                 (row ? fostlib::jcursor{*row} : fostlib::jcursor{})
-                        / col_def.first);
+                        / column.name);
         if (error.first || error.second) return error;
     }
+    return {nullptr, 0};
+}
+
+
+std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::updater::insert(
+        fostlib::json const &body_row,
+        fostgres::updater::intermediate_data d,
+        std::optional<std::size_t> row) {
+    if (auto error = check_insert(body_row, d, row);
+        error.first || error.second) {
+        return error;
+    }
+    return write_insert(d);
+}
+std::pair<boost::shared_ptr<fostlib::mime>, int>
+        fostgres::updater::write_insert(const intermediate_data &d) {
     auto rel = relation;
     if (returning_cols.size()) {
         auto rs = cnx.upsert(
@@ -108,27 +162,50 @@ std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::updater::insert(
 }
 
 
-std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::updater::update(
-        fostlib::json const &combined,
-        fostgres::updater::intermediate_data d,
-        std::optional<std::size_t> row) {
-    auto const [sbody, sstatus] =
-            schema_check(cnx, config, m, req, method_config, combined, {});
+std::pair<boost::shared_ptr<fostlib::mime>, int>
+        fostgres::updater::check_update(
+                fostlib::json const &combined,
+                const fostgres::updater::intermediate_data &d,
+                std::optional<std::size_t> row) {
+    return check_update(config, *plan, combined, d, row);
+}
+std::pair<boost::shared_ptr<fostlib::mime>, int>
+        fostgres::updater::check_update(
+                const fostlib::json &config,
+                const method_plan &plan,
+                fostlib::json const &combined,
+                const fostgres::updater::intermediate_data &d,
+                std::optional<std::size_t>) {
+    auto const [sbody, sstatus] = schema_check(config, plan, combined);
     if (sbody || sstatus) return {sbody, sstatus};
-    for (const auto &col_def : col_config.object()) {
+    for (const auto &column : plan.columns) {
         auto const instance =
-                (col_def.second["key"].get(false)
-                         ? d.first[col_def.first]
-                         : (d.second != fostlib::json()
-                                    ? d.second[col_def.first]
-                                    : fostlib::json()));
+                (column.key ? d.first[column.name]
+                            : (d.second != fostlib::json()
+                                       ? d.second[column.name]
+                                       : fostlib::json()));
         auto const [err_response, err_status] =
-                schema_check(cnx, config, m, req, col_def.second, instance, {});
+                schema_check(config, column, instance);
         if (err_response) { return {err_response, err_status}; }
     }
+    return {nullptr, 0};
+}
+
+
+std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::updater::update(
+        fostlib::json const &combined,
+        fostgres::updater::intermediate_data d,
+        std::optional<std::size_t> row) {
+    if (auto error = check_update(combined, d, row);
+        error.first || error.second) {
+        return error;
+    }
+    write_update(d);
+    return {nullptr, 0};
+}
+void fostgres::updater::write_update(const intermediate_data &d) {
     auto rel = relation;
     cnx.update(rel.shrink_to_fit(), d.first, d.second);
-    return {nullptr, 0};
 }
 
 
@@ -148,52 +225,447 @@ std::tuple<fostlib::json, fostlib::json, boost::shared_ptr<fostlib::mime>, int>
 }
 
 
+/**
+ * ## Batched writes
+ */
+
+
+namespace {
+    /// Postgres allows at most this many parameters in a statement
+    constexpr std::size_t c_max_parameters = 65535;
+
+    void quoted(std::string &into, const fostlib::string &name) {
+        into += '"';
+        for (auto const ch : static_cast<std::string_view>(name)) {
+            if (ch == '"') { into += ch; }
+            into += ch;
+        }
+        into += '"';
+    }
+    template<typename Filter>
+    void quoted(
+            std::string &into,
+            const std::vector<const fostgres::column_definition *> &columns,
+            Filter filter) {
+        bool first = true;
+        for (auto const *column : columns) {
+            if (not filter(*column)) { continue; }
+            if (not first) { into += ", "; }
+            first = false;
+            quoted(into, column->name);
+        }
+    }
+    auto const any_column = [](const fostgres::column_definition &) {
+        return true;
+    };
+    auto const key_column = [](const fostgres::column_definition &c) {
+        return c.key;
+    };
+
+    /// The conflict clause that turns an `INSERT` of the columns into an
+    /// upsert
+    void on_conflict(
+            std::string &sql,
+            const std::vector<const fostgres::column_definition *> &columns) {
+        bool const has_keys =
+                std::any_of(columns.begin(), columns.end(), [](auto const *c) {
+                    return c->key;
+                });
+        bool const has_values =
+                std::any_of(columns.begin(), columns.end(), [](auto const *c) {
+                    return not c->key;
+                });
+        if (not has_keys) { return; }
+        sql += " ON CONFLICT (";
+        quoted(sql, columns, key_column);
+        sql += ") DO ";
+        if (has_values) {
+            sql += "UPDATE SET ";
+            bool first = true;
+            for (auto const *column : columns) {
+                if (column->key) { continue; }
+                if (not first) { sql += ", "; }
+                first = false;
+                quoted(sql, column->name);
+                sql += " = EXCLUDED.";
+                quoted(sql, column->name);
+            }
+        } else {
+            sql += "NOTHING";
+        }
+    }
+
+    /// The columns in `d` that have data
+    std::vector<const fostgres::column_definition *> present_columns(
+            const fostgres::method_plan &plan,
+            const fostgres::updater::intermediate_data &d) {
+        std::vector<const fostgres::column_definition *> present;
+        present.reserve(plan.columns.size());
+        for (auto const &column : plan.columns) {
+            auto const &source = column.key ? d.first : d.second;
+            if (source.isobject() && source.has_key(column.name)) {
+                present.push_back(&column);
+            }
+        }
+        return present;
+    }
+}
+
+
+namespace {
+    /// The text the database is sent for a key value. Keys are compared
+    /// in this form so that `"1"` and `1` are seen as the same key, just
+    /// as they are by `ON CONFLICT`.
+    std::string key_text(const fostlib::json &value) {
+        if (auto const text = value.get<f5::u8view>(); text) {
+            return std::string{text->data(), text->bytes()};
+        } else {
+            f5::u8view const json{fostlib::json::unparse(value, false)};
+            return std::string{json.data(), json.bytes()};
+        }
+    }
+}
+
+
+void fostgres::updater::queue(batch &into, const intermediate_data &d) {
+    auto present = present_columns(*plan, d);
+    if (into.rows.size() && present != into.columns) { flush(); }
+    into.columns = std::move(present);
+
+    std::vector<fostlib::json> row;
+    std::vector<std::string> key;
+    bool null_key = false;
+    row.reserve(into.columns.size());
+    for (auto const *column : into.columns) {
+        row.push_back((column->key ? d.first : d.second)[column->name]);
+        if (column->key) {
+            null_key = null_key || row.back().isnull();
+            key.push_back(key_text(row.back()));
+        }
+    }
+    if (key.empty() || null_key) {
+        /// Without keys, or with a null one, there can't be a conflict, so
+        /// every row is written
+        into.rows.push_back(std::move(row));
+    } else if (auto found = into.keys.find(key); found != into.keys.end()) {
+        /// Only the last write for a key can be kept. A statement can't
+        /// change the same row twice.
+        into.rows[found->second] = std::move(row);
+    } else {
+        into.keys.emplace(std::move(key), into.rows.size());
+        into.rows.push_back(std::move(row));
+    }
+    std::size_t const most = std::min(
+            plan->batch,
+            c_max_parameters / std::max<std::size_t>(into.columns.size(), 1u));
+    if (into.rows.size() >= most) { flush(); }
+}
+
+
+void fostgres::updater::queue_insert(const intermediate_data &d) {
+    if (updates.rows.size()) { write_updates(); }
+    queue(inserts, d);
+}
+void fostgres::updater::queue_update(const intermediate_data &d) {
+    if (inserts.rows.size()) { write_inserts(); }
+    queue(updates, d);
+}
+void fostgres::updater::flush() {
+    write_inserts();
+    write_updates();
+}
+
+
+void fostgres::updater::write_inserts() {
+    if (inserts.rows.empty()) { return; }
+    auto const &columns = inserts.columns;
+
+    /// The arguments are untyped so Postgres takes the types from the
+    /// columns they are inserted into
+    std::vector<fostlib::json> arguments;
+    arguments.reserve(inserts.rows.size() * columns.size());
+    std::string sql{"INSERT INTO "};
+    sql += static_cast<std::string_view>(relation);
+    sql += " (";
+    quoted(sql, columns, any_column);
+    sql += ") VALUES ";
+    for (std::size_t index{}; index < inserts.rows.size(); ++index) {
+        if (index) { sql += ", "; }
+        sql += '(';
+        for (auto &value : inserts.rows[index]) {
+            if (sql.back() != '(') { sql += ", "; }
+            arguments.push_back(std::move(value));
+            sql += '$';
+            sql += std::to_string(arguments.size());
+        }
+        sql += ')';
+    }
+    on_conflict(sql, columns);
+
+    fostgres::log_debug([&](auto &&logger) {
+        logger("", "Batched INSERT")("relation", relation)(
+                "rows", inserts.rows.size());
+    });
+    inserts.rows.clear();
+    inserts.keys.clear();
+    fostgres::exec(cnx, m, f5::u8view{sql}, arguments);
+}
+
+
+void fostgres::updater::write_updates() {
+    if (updates.rows.empty()) { return; }
+    auto const &columns = updates.columns;
+    bool const has_values =
+            std::any_of(columns.begin(), columns.end(), [](auto const *c) {
+                return not c->key;
+            });
+    if (not has_values) {
+        /// There is nothing to change
+        updates.rows.clear();
+        updates.keys.clear();
+        return;
+    }
+
+    /// The rows are sent as a single JSON argument and expanded to the
+    /// table's row type by Postgres so that the key comparisons use the
+    /// column types
+    fostlib::json rows{fostlib::json::array_t()};
+    for (auto const &row : updates.rows) {
+        fostlib::json object{fostlib::json::object_t()};
+        for (std::size_t index{}; index < columns.size(); ++index) {
+            fostlib::insert(object, columns[index]->name, row[index]);
+        }
+        fostlib::push_back(rows, std::move(object));
+    }
+
+    auto const rel = static_cast<std::string_view>(relation);
+    std::string sql{"UPDATE "};
+    sql += rel;
+    sql += " SET ";
+    bool first = true;
+    for (auto const *column : columns) {
+        if (column->key) { continue; }
+        if (not first) { sql += ", "; }
+        first = false;
+        quoted(sql, column->name);
+        sql += " = fg_batch.";
+        quoted(sql, column->name);
+    }
+    sql += " FROM json_populate_recordset(NULL::";
+    sql += rel;
+    sql += ", $1) AS fg_batch WHERE ";
+    first = true;
+    for (auto const *column : columns) {
+        if (not column->key) { continue; }
+        if (not first) { sql += " AND "; }
+        first = false;
+        sql += rel;
+        sql += '.';
+        quoted(sql, column->name);
+        sql += " = fg_batch.";
+        quoted(sql, column->name);
+    }
+    if (first) {
+        throw fostlib::exceptions::not_implemented(
+                __PRETTY_FUNCTION__,
+                "Batched UPDATE needs at least one key column",
+                method_config);
+    }
+
+    fostgres::log_debug([&](auto &&logger) {
+        logger("", "Batched UPDATE")("relation", relation)(
+                "rows", updates.rows.size());
+    });
+    updates.rows.clear();
+    updates.keys.clear();
+    fostgres::exec(
+            cnx, m, f5::u8view{sql}, std::vector<fostlib::json>{rows});
+}
+
+
+/**
+ * ## `fostgres::bulk_loader`
+ */
+
+
+fostgres::bulk_loader::bulk_loader(
+        fostlib::pg::connection &c, std::shared_ptr<const method_plan> p)
+: cnx(c), plan(std::move(p)) {}
+
+
+void fostgres::bulk_loader::add(const updater::intermediate_data &d) {
+    auto present = present_columns(*plan, d);
+    if ((pending_rows || staged_rows) && present != columns) { apply(); }
+    columns = std::move(present);
+
+    fostlib::json row{fostlib::json::object_t()};
+    for (auto const *column : columns) {
+        fostlib::insert(
+                row, column->name,
+                (column->key ? d.first : d.second)[column->name]);
+    }
+    fostlib::push_back(pending, std::move(row));
+    if (++pending_rows >= plan->bulk) { stage(); }
+}
+
+
+void fostgres::bulk_loader::stage() {
+    if (not pending_rows) { return; }
+    auto const relation = static_cast<std::string_view>(plan->table);
+    /// The staging table is created and dropped within the request, so
+    /// none of these statements go through the statement cache
+    if (not staged_rows) {
+        /// Taking the columns from the table gives them the right types,
+        /// but none of its constraints
+        std::string sql{"CREATE TEMPORARY TABLE fg_bulk ON COMMIT DROP AS "
+                        "SELECT "};
+        quoted(sql, columns, any_column);
+        sql += ", 0::bigint AS fg_row FROM ";
+        sql += relation;
+        sql += " WITH NO DATA";
+        fostgres::exec(cnx, f5::u8view{sql}, std::vector<fostlib::json>{});
+    }
+    /// The rows are expanded to the table's row type by Postgres. Their
+    /// position is kept so that the last row for a key can be used
+    std::string sql{"INSERT INTO fg_bulk SELECT "};
+    quoted(sql, columns, any_column);
+    sql += ", $2::bigint + ordinality FROM json_populate_recordset(NULL::";
+    sql += relation;
+    sql += ", $1) WITH ORDINALITY AS fg_rows";
+    fostgres::log_debug([&](auto &&logger) {
+        logger("", "Bulk load staging")("relation", plan->table)(
+                "rows", pending_rows)("staged", staged_rows);
+    });
+    fostgres::exec(
+            cnx, f5::u8view{sql},
+            std::vector<fostlib::json>{
+                    std::move(pending), fostlib::json{int64_t(staged_rows)}});
+    staged_rows += pending_rows;
+    pending = fostlib::json{};
+    pending_rows = 0;
+}
+
+
+void fostgres::bulk_loader::apply() {
+    stage();
+    if (not staged_rows) { return; }
+    bool const has_keys =
+            std::any_of(columns.begin(), columns.end(), [](auto const *c) {
+                return c->key;
+            });
+
+    /// A statement can't change the same row twice, so where the key
+    /// appears more than once only the last row is used. This gives the
+    /// same result as writing the rows one at a time.
+    std::string sql{"INSERT INTO "};
+    sql += static_cast<std::string_view>(plan->table);
+    sql += " (";
+    quoted(sql, columns, any_column);
+    sql += ") SELECT ";
+    if (has_keys) {
+        sql += "DISTINCT ON (";
+        quoted(sql, columns, key_column);
+        sql += ") ";
+    }
+    quoted(sql, columns, any_column);
+    sql += " FROM fg_bulk";
+    if (has_keys) {
+        sql += " ORDER BY ";
+        quoted(sql, columns, key_column);
+        sql += ", fg_row DESC";
+    }
+    on_conflict(sql, columns);
+
+    fostgres::log_debug([&](auto &&logger) {
+        logger("", "Bulk load")("relation", plan->table)(
+                "rows", staged_rows);
+    });
+    fostgres::exec(cnx, f5::u8view{sql}, std::vector<fostlib::json>{});
+    fostgres::exec(
+            cnx, f5::u8view{"DROP TABLE fg_bulk"},
+            std::vector<fostlib::json>{});
+    staged_rows = 0;
+}
+
+
 /**
  * ## Schema validation
  */
 
 
+namespace {
+    std::pair<boost::shared_ptr<fostlib::mime>, int> check(
+            const fostlib::json &config,
+            const fostlib::json &s_config,
+            const f5::json::schema *compiled,
+            const fostlib::json &body,
+            const fostlib::jcursor &dpos) {
+        const std::pair<boost::shared_ptr<fostlib::mime>, int> ok{nullptr, 0};
+        const auto validate = [&](const f5::json::schema &s) {
+            if (auto valid = s.validate(body); not valid) {
+                const bool pretty = fostlib::coerce<fostlib::nullable<bool>>(
+                                            config["pretty"])
+                                            .value_or(true);
+                fostlib::json result;
+                fostlib::insert(result, "schema", s_config["schema"]);
+                auto e{(f5::json::validation::result::error)std::move(valid)};
+                fostlib::insert(result, "error", "assertion", e.assertion);
+                fostlib::insert(result, "error", "in-schema", e.spos);
+                fostlib::insert(result, "error", "in-data", dpos / e.dpos);
+                boost::shared_ptr<fostlib::mime> response(
+                        new fostlib::text_body(
+                                fostlib::json::unparse(result, pretty),
+                                fostlib::mime::mime_headers(),
+                                "application/json"));
+                return std::make_pair(response, 422);
+            } else {
+                return ok;
+            }
+        };
+
+        const bool allow_schema =
+                fostlib::coerce<std::optional<bool>>(s_config["allow$schema"])
+                        .value_or(false);
+        if (allow_schema && body.has_key("$schema")) {
+            return validate(
+                    (*f5::json::schema_cache::root_cache())
+                            [fostlib::coerce<f5::u8view>(body["$schema"])]);
+        } else if (compiled) {
+            return validate(*compiled);
+        } else if (s_config.has_key("schema")) {
+            f5::json::schema s{fostlib::url{}, s_config["schema"]};
+            return validate(s);
+        } else {
+            return ok;
+        }
+    }
+}
+
+
 std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::schema_check(
-        fostlib::pg::connection &cnx,
+        fostlib::pg::connection &,
         const fostlib::json &config,
-        const fostgres::match &m,
-        fostlib::http::server::request &req,
+        const fostgres::match &,
+        fostlib::http::server::request &,
         const fostlib::json &s_config,
         const fostlib::json &body,
         fostlib::jcursor dpos) {
-    const std::pair<boost::shared_ptr<fostlib::mime>, int> ok{nullptr, 0};
-    const auto validate = [&](const f5::json::schema &s) {
-        if (auto valid = s.validate(body); not valid) {
-            const bool pretty =
-                    fostlib::coerce<fostlib::nullable<bool>>(config["pretty"])
-                            .value_or(true);
-            fostlib::json result;
-            fostlib::insert(result, "schema", s_config["schema"]);
-            auto e{(f5::json::validation::result::error)std::move(valid)};
-            fostlib::insert(result, "error", "assertion", e.assertion);
-            fostlib::insert(result, "error", "in-schema", e.spos);
-            fostlib::insert(result, "error", "in-data", dpos / e.dpos);
-            boost::shared_ptr<fostlib::mime> response(new fostlib::text_body(
-                    fostlib::json::unparse(result, pretty),
-                    fostlib::mime::mime_headers(), "application/json"));
-            return std::make_pair(response, 422);
-        } else {
-            return ok;
-        }
-    };
-
-    const bool allow_schema =
-            fostlib::coerce<std::optional<bool>>(s_config["allow$schema"])
-                    .value_or(false);
-    if (allow_schema && body.has_key("$schema")) {
-        return validate((*f5::json::schema_cache::root_cache())
-                                [fostlib::coerce<f5::u8view>(body["$schema"])]);
-    } else if (s_config.has_key("schema")) {
-        f5::json::schema s{fostlib::url{}, s_config["schema"]};
-        return validate(s);
-    } else {
-        return ok;
-    }
+    return check(config, s_config, nullptr, body, dpos);
+}
+std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::schema_check(
+        const fostlib::json &config,
+        const method_plan &plan,
+        const fostlib::json &body,
+        const fostlib::jcursor &dpos) {
+    return check(config, plan.configuration, plan.schema.get(), body, dpos);
+}
+std::pair<boost::shared_ptr<fostlib::mime>, int> fostgres::schema_check(
+        const fostlib::json &config,
+        const column_definition &column,
+        const fostlib::json &instance,
+        const fostlib::jcursor &dpos) {
+    return check(
+            config, column.configuration, column.schema.get(), instance, dpos);
 }
 
 
@@ -207,28 +679,77 @@ fostgres::put_records_seen::put_records_seen(
         f5::u8view select_sql,
         const match &mm,
         fostlib::http::server::request &req)
-: cnx{c}, m{mm} {
+: cnx{c}, m{mm}, selected{true} {
     auto rs = select_data(cnx, select_sql, m, req);
+    key_names = std::move(rs.first);
+    starts.push_back(0);
+
+    /// Keep the table no more than half full
+    std::size_t capacity{16};
+    while (capacity < 2 * rs.second.size()) { capacity *= 2; }
+    slots.resize(capacity);
+
     for (const auto &row : rs.second) {
-        std::vector<fostlib::json> keys;
+        key_buffer.clear();
         for (std::size_t index{}; index != row.size(); ++index) {
-            keys.push_back(row[index]);
+            if (index) { key_buffer += ','; }
+            key_buffer += static_cast<std::string_view>(
+                    fostlib::json::unparse(row[index], false));
+        }
+        /// Duplicate keys are only stored once
+        if (auto &slot = slot_for(key_buffer); not slot) {
+            arena += key_buffer;
+            starts.push_back(arena.size());
+            seen.push_back(false);
+            slot = seen.size();
+        }
+    }
+    arena.shrink_to_fit();
+}
+
+
+fostgres::put_records_seen::put_records_seen(
+        fostlib::pg::connection &c, const match &mm)
+: cnx{c}, m{mm}, selected{false} {}
+
+
+std::string_view fostgres::put_records_seen::key(std::size_t const n) const {
+    return std::string_view{arena}.substr(starts[n], starts[n + 1] - starts[n]);
+}
+
+
+void fostgres::put_records_seen::serialise(
+        std::string &into, fostlib::json const &inserted) const {
+    into.clear();
+    for (const auto &k : key_names) {
+        if (into.size()) { into += ','; }
+        into += static_cast<std::string_view>(
+                fostlib::json::unparse(inserted[k], false));
+    }
+}
+
+
+std::size_t &fostgres::put_records_seen::slot_for(std::string_view k) {
+    auto const mask = slots.size() - 1;
+    for (auto index = std::hash<std::string_view>{}(k) & mask;;
+         index = (index + 1) & mask) {
+        if (not slots[index] || key(slots[index] - 1) == k) {
+            return slots[index];
         }
-        records.push_back(std::make_pair(std::move(keys), false));
     }
-    std::sort(records.begin(), records.end());
-    key_names = std::move(rs.first);
-    key_match.reserve(key_names.size());
 }
 
 
 bool fostgres::put_records_seen::record(fostlib::json const &inserted) {
-    key_match.clear();
-    for (const auto &k : key_names) { key_match.push_back(inserted[k]); }
-    auto found = std::lower_bound(
-            records.begin(), records.end(), std::make_pair(key_match, false));
-    if (found != records.end() && found->first == key_match) {
-        found->second = true;
+    if (not selected) {
+        if (arena.size()) { arena += ','; }
+        arena += static_cast<std::string_view>(
+                fostlib::json::unparse(inserted, false));
+        return false;
+    }
+    serialise(key_buffer, inserted);
+    if (auto const slot = slot_for(key_buffer); slot) {
+        seen[slot - 1] = true;
         return true;
     }
     return false;
@@ -237,22 +758,43 @@ bool fostgres::put_records_seen::record(fostlib::json const &inserted) {
 
 std::size_t fostgres::put_records_seen::delete_left_over_records(
         f5::u8view delete_sql) {
-    auto sp = cnx.procedure(fostlib::utf8_string{delete_sql});
     std::vector<fostlib::json> keys(m.arguments.size() + key_names.size());
     std::transform(
             m.arguments.begin(), m.arguments.end(), keys.begin(),
             [&](const auto &arg) { return fostlib::json(arg); });
     std::size_t deleted{0};
-    for (const auto &record : records) {
-        if (not record.second) {
+    for (std::size_t index{}; index != seen.size(); ++index) {
+        if (not seen[index]) {
             // The record wasn't "seen" during the upload so we're
             // going to delete it.
+            auto const k = key(index);
+            auto const record = fostlib::json::parse(fostlib::string{
+                    "[" + std::string(k.data(), k.size()) + "]"});
             std::copy(
-                    record.first.begin(), record.first.end(),
+                    record.begin(), record.end(),
                     keys.begin() + m.arguments.size());
-            sp.exec(keys);
+            fostgres::exec(cnx, m, delete_sql, keys);
             ++deleted;
         }
     }
     return deleted;
 }
+
+
+std::size_t fostgres::put_records_seen::delete_unseen_records(
+        f5::u8view delete_sql, bool const has_returning) {
+    std::vector<fostlib::string> arguments{m.arguments};
+    arguments.emplace_back("[" + arena + "]");
+    /// The statement is wrapped so the number of rows deleted can be
+    /// read back without the configuration having to return it
+    std::string sql{"WITH fg_deleted AS ("};
+    sql.append(delete_sql.data(), delete_sql.bytes());
+    if (not has_returning) { sql += " RETURNING 1"; }
+    sql += ") SELECT count(*) FROM fg_deleted";
+    auto rs = fostgres::exec(cnx, m, f5::u8view{sql}, arguments);
+    std::size_t deleted{};
+    for (const auto &row : rs) {
+        deleted = fostlib::coerce<int64_t>(row[0]);
+    }
+    return deleted;
+}
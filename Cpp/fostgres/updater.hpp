@@ -10,6 +10,7 @@
 
 
 #include <fostgres/matcher.hpp>
+#include <fostgres/plan.hpp>
 #include <fostgres/response.hpp>
 #include <fostgres/sql.hpp>
 
@@ -26,6 +27,10 @@ namespace fostgres {
                 fostlib::pg::connection &,
                 const fostgres::match &,
                 fostlib::http::server::request &);
+        updater(std::shared_ptr<const method_plan>,
+                fostlib::pg::connection &,
+                const fostgres::match &,
+                fostlib::http::server::request &);
 
         /// Returning data
         const std::vector<fostlib::string> returning() const {
@@ -49,19 +54,77 @@ namespace fostgres {
         using intermediate_data = std::pair<fostlib::json, fostlib::json>;
         [[nodiscard]] intermediate_data data(const fostlib::json &data);
 
+        /// The data and schema checks for plans whose columns are all
+        /// pure. These use neither the database nor the request, so they
+        /// can be used from any thread.
+        [[nodiscard]] static intermediate_data
+                data(const method_plan &,
+                     const std::vector<fostlib::string> &arguments,
+                     const fostlib::json &data,
+                     action &);
+        [[nodiscard]] static std::pair<boost::shared_ptr<fostlib::mime>, int>
+                check_insert(
+                        const fostlib::json &config,
+                        const method_plan &,
+                        fostlib::json const &body_row,
+                        const intermediate_data &,
+                        std::optional<std::size_t> row = {});
+        [[nodiscard]] static std::pair<boost::shared_ptr<fostlib::mime>, int>
+                check_update(
+                        const fostlib::json &config,
+                        const method_plan &,
+                        fostlib::json const &body_row,
+                        const intermediate_data &,
+                        std::optional<std::size_t> row = {});
+
+        /// Perform the schema checks needed before an `INSERT`
+        [[nodiscard]] std::pair<boost::shared_ptr<fostlib::mime>, int>
+                check_insert(
+                        fostlib::json const &body_row,
+                        const intermediate_data &,
+                        std::optional<std::size_t> row = {});
         /// Perform an INSERT and potentially return a response
         [[nodiscard]] std::pair<boost::shared_ptr<fostlib::mime>, int>
                 insert(fostlib::json const &body_row,
                        intermediate_data,
                        std::optional<std::size_t> row = {});
+        /// Perform the schema checks needed before an `UPDATE`
+        [[nodiscard]] std::pair<boost::shared_ptr<fostlib::mime>, int>
+                check_update(
+                        fostlib::json const &body_row,
+                        const intermediate_data &,
+                        std::optional<std::size_t> row = {});
         /// Perform an update
         [[nodiscard]] std::pair<boost::shared_ptr<fostlib::mime>, int>
                 update(fostlib::json const &body_row,
                        intermediate_data,
                        std::optional<std::size_t> row = {});
 
+        /// Perform the `INSERT` or `UPDATE` for data that has already been
+        /// checked
+        [[nodiscard]] std::pair<boost::shared_ptr<fostlib::mime>, int>
+                write_insert(const intermediate_data &);
+        void write_update(const intermediate_data &);
+
         action perform() const { return deduced_action; }
 
+        /// ## Batched writes
+        ///
+        /// When the method configuration has a `batch` size (and no
+        /// `returning`) rows can be queued instead of being written one
+        /// at a time. The rows must already have been checked with
+        /// `check_insert` or `check_update`. Rows are written when a batch
+        /// is full, when a row has data for a different set of columns, or
+        /// when the other kind of write is queued, so the writes happen in
+        /// the same order as the rows were queued.
+        bool batching() const {
+            return plan->batch && returning_cols.empty();
+        }
+        void queue_insert(const intermediate_data &);
+        void queue_update(const intermediate_data &);
+        /// Write all queued rows
+        void flush();
+
         /// The old APIs which combine the UPDATE/INSERT with the
         /// data processing.
         [[nodiscard]] std::pair<
@@ -78,12 +141,63 @@ namespace fostgres {
 
       private:
         action deduced_action;
-        fostlib::json config, method_config, col_config;
-        std::vector<fostlib::string> returning_cols;
+        std::shared_ptr<const method_plan> plan;
+        fostlib::json config;
+        const fostlib::json &method_config;
+        const std::vector<fostlib::string> &returning_cols;
 
         fostlib::pg::connection &cnx;
         const fostgres::match &m;
         fostlib::http::server::request &req;
+
+        struct batch {
+            /// The columns the rows in the batch have data for
+            std::vector<const column_definition *> columns;
+            std::vector<std::vector<fostlib::json>> rows;
+            /// Where in `rows` each key is so a later row with the same key
+            /// replaces the earlier one. Only used when the method has key
+            /// columns, otherwise every row is kept.
+            std::map<std::vector<std::string>, std::size_t> keys;
+        } inserts, updates;
+        void queue(batch &, const intermediate_data &);
+        void write_inserts();
+        void write_updates();
+    };
+
+
+    /// Bulk loading of CSJ `PUT` and `PATCH` bodies. The rows are sent to
+    /// a temporary staging table, `bulk` rows per statement, and then all
+    /// of them are written to the table by a single set based
+    /// `INSERT ... ON CONFLICT DO UPDATE`. The rows must already have been
+    /// through `updater::data` and `updater::check_insert`.
+    class bulk_loader {
+      public:
+        bulk_loader(
+                fostlib::pg::connection &, std::shared_ptr<const method_plan>);
+
+        /// True if the method is configured for bulk loading
+        static bool wanted(const method_plan &p) {
+            return p.bulk && p.returning.empty();
+        }
+
+        /// Stage a row. A row with data for a different set of columns
+        /// first causes the rows already staged to be applied.
+        void add(const updater::intermediate_data &);
+        /// Write all staged rows to the table
+        void apply();
+
+      private:
+        fostlib::pg::connection &cnx;
+        std::shared_ptr<const method_plan> plan;
+
+        /// The columns the staged rows have data for
+        std::vector<const column_definition *> columns;
+        /// Rows not yet sent to the staging table
+        fostlib::json pending;
+        std::size_t pending_rows = 0;
+        /// Rows in the staging table
+        std::size_t staged_rows = 0;
+        void stage();
     };
 
 
@@ -95,6 +209,18 @@ namespace fostgres {
             const fostlib::json &schema_config,
             const fostlib::json &instance,
             fostlib::jcursor dpos);
+    /// Check against the schemas compiled into the plan. These don't use
+    /// the database or the request.
+    std::pair<boost::shared_ptr<fostlib::mime>, int> schema_check(
+            const fostlib::json &config,
+            const method_plan &,
+            const fostlib::json &instance,
+            const fostlib::jcursor &dpos = {});
+    std::pair<boost::shared_ptr<fostlib::mime>, int> schema_check(
+            const fostlib::json &config,
+            const column_definition &,
+            const fostlib::json &instance,
+            const fostlib::jcursor &dpos = {});
 
 
     /**
@@ -112,23 +238,27 @@ namespace fostgres {
      *  in the database. We need to SELECT across the keys not in
      *  the body data and store the keys that are in the body data
      *
-     *  The bool is set to true when the key has been seen. Those still
-     *  false by the end of the PUT need to be deleted.
+     *  Each key is stored as its JSON serialisation in a single byte
+     *  arena, and found through an open addressing hash table of key
+     *  numbers. A bit per key records whether it has been seen. Those
+     *  still clear by the end of the PUT need to be deleted.
+     *
+     *  When the configuration has `delete-unseen` SQL no `SELECT` is done.
+     *  The keys in the body are collected instead and the database works
+     *  out which rows to delete in a single statement.
      */
     struct put_records_seen {
-        using storage_type =
-                std::vector<std::pair<std::vector<fostlib::json>, bool>>;
-        storage_type records;
-
         put_records_seen(
                 fostlib::pg::connection &,
                 f5::u8view select_sql,
                 const match &,
                 fostlib::http::server::request &);
+        /// Only collect the keys in the body
+        put_records_seen(fostlib::pg::connection &, const match &);
 
         /// The number of records in the database before processing the
         /// PUT request.
-        auto size() const noexcept { return records.size(); }
+        std::size_t size() const noexcept { return seen.size(); }
 
         /// Look to see if we had this data in the database before
         /// and if so mark it as seen in the PUT body
@@ -137,12 +267,35 @@ namespace fostgres {
         /// Look through the initial keys to find any that weren't in the
         /// incoming data in the PUT body so the rows can be deleted
         std::size_t delete_left_over_records(f5::u8view delete_sql);
+        /// Run the `delete-unseen` SQL with the path arguments followed by
+        /// a JSON array of the keys recorded from the body. Returns the
+        /// number of rows deleted, which is the number of rows returned if
+        /// the SQL has its own `RETURNING` clause
+        std::size_t delete_unseen_records(
+                f5::u8view delete_sql, bool has_returning);
 
       private:
         fostlib::pg::connection &cnx;
         match const &m;
-        std::vector<fostlib::json> key_match;
+        /// False when only the keys in the body are being collected
+        bool const selected;
         ordered_keys<fostlib::string> key_names;
+
+        /// The serialised keys, one after the other. Key `n` runs from
+        /// `starts[n]` to `starts[n + 1]`. When only collecting the keys
+        /// from the body these are comma separated JSON objects instead
+        std::string arena;
+        std::vector<std::size_t> starts;
+        /// Key number plus one, zero for an empty slot. The size is always
+        /// a power of two
+        std::vector<std::size_t> slots;
+        std::vector<bool> seen;
+        /// Scratch space for serialising the incoming keys
+        std::string key_buffer;
+
+        std::string_view key(std::size_t) const;
+        void serialise(std::string &into, fostlib::json const &) const;
+        std::size_t &slot_for(std::string_view);
     };
 
 
@@ -9,8 +9,7 @@
 #pragma once
 
 
-#include <fost/split.hpp>
-#include <fost/parse/json.hpp>
+#include <fost/json>
 
 
 namespace fostlib {
@@ -19,52 +18,24 @@ namespace fostlib {
     namespace csj {
 
 
-        template<typename Iterator>
-        struct headers_parser :
-        boost::spirit::qi::grammar<Iterator, std::vector<string>()> {
-            using vector_type = std::vector<string>;
-
-            boost::spirit::qi::rule<Iterator, vector_type()> top;
-            json_string_parser<Iterator> str;
-
-            headers_parser() : headers_parser::base_type(top) {
-                top = str
-                        % (*boost::spirit::qi::lit(' ')
-                           >> boost::spirit::qi::lit(',')
-                           >> *boost::spirit::qi::lit(' '));
-            }
-        };
-
-
-        template<typename Iterator>
-        struct line_parser :
-        boost::spirit::qi::grammar<Iterator, std::vector<json>()> {
-            using vector_type = std::vector<json>;
-
-            boost::spirit::qi::rule<Iterator, vector_type()> top;
-            json_embedded_parser<Iterator> item;
-
-            line_parser() : line_parser::base_type(top) {
-                top = item
-                        % (*boost::spirit::qi::lit(' ')
-                           >> boost::spirit::qi::lit(',')
-                           >> *boost::spirit::qi::lit(' '));
-            }
-        };
-
-
         /// Iterate over a file of CSJ like data
         class parser {
-            using line_iter_t = splitter_result<f5::u8view, f5::u8view, 1u>;
-            line_iter_t line_iter;
-            line_iter_t::const_iterator li_pos, li_end;
+            f5::u8view text;
+            /// The byte offset of the start of each line. There is an extra
+            /// entry at the end so that each line finishes one byte before
+            /// the start of the next.
+            std::vector<std::size_t> line_starts;
+            /// One bit per byte of the text, set for the commas and
+            /// brackets that aren't inside a string
+            std::vector<uint64_t> structure;
             std::vector<fostlib::string> headers;
-            headers_parser<
-                    f5::cord::const_u32u16_iterator<f5::u8view::const_iterator>>
-                    headers_p;
-            line_parser<
-                    f5::cord::const_u32u16_iterator<f5::u8view::const_iterator>>
-                    line_p;
+
+            /// The number of lines in the text
+            std::size_t lines() const noexcept {
+                return line_starts.size() - 1u;
+            }
+            /// The text of a line, without its new line
+            f5::u8view line(std::size_t) const;
 
           public:
             /// Initialise from a string
@@ -73,13 +44,28 @@ namespace fostlib {
             /// Return the header column names
             const auto &header() const { return headers; }
 
+            /// The number of rows after the headers, including any blank
+            /// lines at the end
+            std::size_t rows() const noexcept { return lines() - 1u; }
+            /// Parse a single row, where row zero is the line after the
+            /// headers. A blank line gives an empty vector. This doesn't
+            /// change the parser, so rows can be parsed from many threads
+            /// at the same time.
+            std::vector<json> parse_row(std::size_t row) const;
+            /// Turn a parsed row into an object keyed by the headers
+            json as_json(const std::vector<json> &) const;
+
             class const_iterator {
                 friend class parser;
                 const parser &owner;
-                line_iter_t::const_iterator pos;
+                /// The index of the line. The line number used in error
+                /// reports is one more than this.
+                std::size_t pos;
                 std::vector<fostlib::json> line;
 
-                const_iterator(const parser &, line_iter_t::const_iterator);
+                const_iterator(const parser &, std::size_t);
+                /// Move to the end, checking the rest of the lines are blank
+                void only_blank_lines();
 
               public:
                 /// Return the current line
@@ -21,6 +21,10 @@ namespace fostgres {
             fostlib::json,
             const fostlib::nullable<fostlib::string> &,
             const fostlib::http::server::request &);
+    /// Run the registered callbacks and set the per-request session
+    /// variables on a connection that is about to serve the request.
+    void connection_established(
+            fostlib::pg::connection &, const fostlib::http::server::request &);
 
 
     /// Register a callback to be called when a database connection
@@ -37,9 +41,8 @@ namespace fostgres {
         ~register_cnx_callback();
 
       private:
-        friend fostlib::pg::connection fostgres::connection(
-                fostlib::json,
-                const fostlib::nullable<fostlib::string> &,
+        friend void fostgres::connection_established(
+                fostlib::pg::connection &,
                 const fostlib::http::server::request &);
         void operator()(
                 fostlib::pg::connection &c,
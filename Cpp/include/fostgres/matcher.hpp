@@ -10,14 +10,40 @@
 
 
 #include <fost/core>
+#include <fost/postgres>
+
+#include <memory>
+#include <optional>
 
 
 namespace fostgres {
 
 
+    struct endpoint;
+    class pooled_connection;
+
+
     struct match {
         fostlib::json configuration;
         std::vector<fostlib::string> arguments;
+        /// The compiled end point, if the match came from a compiled view
+        mutable std::shared_ptr<const fostgres::endpoint> compiled = {};
+        /// The request's connection lease, when there is one. The view
+        /// owns it until a responder takes it with `take_lease`
+        std::optional<pooled_connection> *lease = nullptr;
+
+        /// Return the compiled end point configuration, compiling it now if
+        /// the match didn't come from a compiled view
+        const fostgres::endpoint &plan() const;
+
+        /// The request's lease, if there is one and it is for the
+        /// connection
+        pooled_connection *lease_for(const fostlib::pg::connection &) const;
+        /// Move the request's lease out so it can outlive the view's
+        /// response. Empty if there is no lease for the connection, or
+        /// it has already been taken
+        std::unique_ptr<pooled_connection>
+                take_lease(const fostlib::pg::connection &) const;
     };
 
 
@@ -0,0 +1,204 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fostgres/datum.hpp>
+#include <fostgres/matcher.hpp>
+#include <fostgres/response.hpp>
+#include <f5/json/schema.hpp>
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+
+namespace fostgres {
+
+
+    class shard_map;
+
+
+    /**
+     * ## Compiled view configuration
+     *
+     * The `fostgres.sql` view configuration is compiled into these
+     * structures the first time it is seen. They are immutable after that
+     * and shared by all of the requests (and threads) that use the view.
+     */
+
+
+    /// One element of an end point's `path`
+    struct path_segment {
+        /// Fixed text that must appear in the URL (without the leading `/`)
+        fostlib::string literal;
+        /// The argument number the URL text is captured into. Zero for fixed
+        /// text.
+        std::size_t argument = 0;
+        /// True if the element is neither fixed text nor a valid argument
+        /// number. These are reported when they are matched against.
+        bool invalid = false;
+    };
+
+
+    /// A `SELECT` configuration, either plain SQL or an object with
+    /// `command` and `arguments` keys
+    struct select_plan {
+        select_plan() = default;
+        explicit select_plan(fostlib::json);
+
+        fostlib::json configuration;
+        fostlib::string command;
+        /// Datum sources for the SQL arguments. When not present the path
+        /// arguments are used
+        std::optional<std::vector<fostlib::json>> arguments;
+
+        explicit operator bool() const { return not configuration.isnull(); }
+    };
+
+
+    /// A column from the `columns` of a `PUT`, `PATCH` or `POST`
+    struct column_definition {
+        column_definition(fostlib::string name, fostlib::json configuration);
+
+        fostlib::string name;
+        fostlib::json configuration;
+        /// The column is part of the key
+        bool key;
+        /// Missing data for this column means an `UPDATE` has to be used
+        bool insert_required;
+        /// Where the column's value comes from
+        column_source source;
+        /// The compiled `schema`, if there is one
+        std::shared_ptr<const f5::json::schema> schema;
+    };
+
+
+    /// The configuration for a `PUT`, `PATCH` or `POST`
+    struct method_plan {
+        explicit method_plan(fostlib::json);
+
+        fostlib::json configuration;
+        fostlib::string table;
+        std::vector<column_definition> columns;
+        /// True if every column's source is `pure`
+        bool pure_columns = true;
+        std::vector<fostlib::string> returning;
+        /// The compiled `schema` for the body, if there is one
+        std::shared_ptr<const f5::json::schema> schema;
+        /// SQL used to find the existing rows for a `PUT`
+        std::optional<fostlib::string> existing;
+        /// SQL used to delete rows not present in a `PUT`
+        std::optional<fostlib::string> delete_sql;
+        /// SQL that deletes the rows not present in a `PUT` in one go
+        std::optional<fostlib::string> delete_unseen;
+        /// True if the `delete_unseen` SQL has its own `RETURNING` clause
+        bool delete_unseen_returns = false;
+        /// The position in the body of the array to `PUT`
+        std::optional<fostlib::jcursor> array;
+        /// The number of rows written by each multi-row statement when
+        /// batching writes. Zero writes the rows one at a time.
+        std::size_t batch = 0;
+        /// The number of CSJ rows sent to the staging table by each
+        /// statement when bulk loading. Zero turns bulk loading off.
+        std::size_t bulk = 0;
+        /// The number of threads used to parse and check a CSJ body. Zero
+        /// or one does the work on the request thread.
+        std::size_t parallel = 0;
+    };
+
+
+    /// A single end point from the `sql` configuration
+    struct endpoint {
+        explicit endpoint(fostlib::json);
+
+        fostlib::json configuration;
+        /// End points without a `path` never match anything
+        std::optional<std::vector<path_segment>> path;
+
+        /// The responder named in `return`
+        std::optional<fostlib::string> returns;
+        responder_function responder;
+
+        /// The `precondition` predicate and the view to use when it fails
+        bool has_precondition = false;
+        fostlib::json precondition, precondition_failed;
+
+        select_plan get;
+        /// The number of rows fetched at a time when a `GET` is streamed
+        /// from a cursor. Zero reads the whole result before responding.
+        std::size_t stream = 0;
+        /// `GET` and `HEAD` run in a `READ ONLY` transaction. A
+        /// `deferrable` one is also `SERIALIZABLE` and waits for a
+        /// snapshot that can't be cancelled by other transactions.
+        bool read_only = false, deferrable = false;
+        /// `GET` and `HEAD` can be sent to one of the view's `replicas`.
+        /// Only end points using the built in responders, and without a
+        /// `sql.exists` precondition, can be. `"replica": false` turns it
+        /// off.
+        bool replica = false;
+        /// The path argument whose value picks the server from the
+        /// view's `shards`. Zero when the end point isn't sharded.
+        std::size_t shard = 0;
+        std::vector<std::shared_ptr<const method_plan>> put, patch, post;
+        std::optional<fostlib::string> del;
+
+        /// All of the configurations given for the method
+        const std::vector<std::shared_ptr<const method_plan>> &
+                methods(f5::u8view method) const;
+        /// The configuration for a method that only supports one
+        const std::shared_ptr<const method_plan> &
+                method(f5::u8view method) const;
+    };
+
+
+    /// A compiled `fostgres.sql` view configuration
+    class view_plan {
+      public:
+        /// Compile the `sql` part of a view configuration. Either a single
+        /// end point or an array of them
+        explicit view_plan(const fostlib::json &sql);
+
+        std::vector<std::shared_ptr<const endpoint>> endpoints;
+        /// The view's `shards`, if it has any. Only set on plans made by
+        /// `compiled`
+        std::shared_ptr<const shard_map> shards;
+
+        /// Find the first end point that matches the path
+        fostlib::nullable<match> matcher(f5::u8view path) const;
+
+        /// Return the compiled form of the view configuration. Compilation
+        /// only happens the first time a configuration is seen, and a
+        /// configuration with the same JSON text shares the plan while it
+        /// is still cached or in use.
+        static std::shared_ptr<const view_plan>
+                compiled(const fostlib::json &view_configuration);
+
+      private:
+        /// The end point paths are stored as a trie of path segments. Fixed
+        /// text and path arguments are kept apart so that a URL segment is
+        /// only compared against the fixed text it could match.
+        struct trie_node {
+            std::map<std::string, std::size_t, std::less<>> literals;
+            /// Child node for any path argument, zero if there isn't one
+            std::size_t capture = 0;
+            /// The first end point whose path ends at this node
+            std::size_t endpoint;
+            /// The first end point whose path goes through this node
+            std::size_t lowest;
+        };
+        std::vector<trie_node> nodes;
+
+        void add(std::size_t endpoint_index);
+        std::size_t search(
+                std::size_t node, std::string_view path, std::size_t best) const;
+    };
+
+}
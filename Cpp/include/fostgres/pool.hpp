@@ -0,0 +1,97 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fost/http.server.hpp>
+#include <fost/postgres>
+#include <fostgres/statements.hpp>
+
+#include <memory>
+
+
+namespace fostgres {
+
+
+    /// Thrown when a pooled connection doesn't become free before the
+    /// pool's `wait` is up. The `fostgres.sql` view responds with a 503.
+    class pool_exhausted : public fostlib::exceptions::exception {
+      public:
+        pool_exhausted(const fostlib::json &dsn, std::size_t max);
+
+      protected:
+        const wchar_t *const message() const noexcept override;
+    };
+
+
+    /// A database connection borrowed for the duration of a request.
+    ///
+    /// If the view configuration has a `pool` key then the connection is
+    /// taken from a pool of warm connections kept for the resolved DSN,
+    /// otherwise a new connection is made exactly as `fostgres::connection`
+    /// does. Either way the registered connection callbacks are run and the
+    /// session variables are set for the request.
+    class pooled_connection {
+      public:
+        struct pool;
+
+        pooled_connection(
+                fostlib::json config, const fostlib::http::server::request &);
+        pooled_connection(pooled_connection &&);
+        pooled_connection(const pooled_connection &) = delete;
+        pooled_connection &operator=(const pooled_connection &) = delete;
+        ~pooled_connection();
+
+        fostlib::pg::connection &operator*() { return *cnx; }
+        fostlib::pg::connection *operator->() { return cnx.get(); }
+
+        /// True if this is the lease for the connection
+        bool leases(const fostlib::pg::connection &c) const {
+            return cnx.get() == &c;
+        }
+        /// The prepared statement cache to use with the connection. Null
+        /// if the lease has none, or is for a different connection.
+        statement_cache *statements_for(const fostlib::pg::connection &c) {
+            return leases(c) ? statements.get() : nullptr;
+        }
+
+        /// Roll back the current transaction, reset the session and hand
+        /// the connection back to its pool. If neither this nor `commit`
+        /// is called the connection is closed (rolling back any open
+        /// transaction) when the lease is destroyed. For connections not
+        /// from a pool this does nothing.
+        void release();
+        /// As `release`, but the transaction is committed. Only used once a
+        /// request has succeeded in writing.
+        void commit();
+
+        /// Roll back the transaction the connection was set up in and
+        /// start a new one with `begin` (a `BEGIN` statement). The
+        /// connection callbacks and session variables are then set up
+        /// again inside it. Used when the transaction's mode has to be
+        /// set before any other statement runs in it.
+        void restart(
+                f5::u8view begin, const fostlib::http::server::request &);
+
+        /// The number of connections lent out by the pool that the
+        /// configuration would use. Always zero when there is no `pool`.
+        static std::size_t
+                in_use(fostlib::json config,
+                       const fostlib::http::server::request &);
+
+      private:
+        void finish(bool commit);
+
+        std::shared_ptr<pool> owner;
+        std::unique_ptr<fostlib::pg::connection> cnx;
+        std::shared_ptr<statement_cache> statements;
+    };
+
+
+}
@@ -42,6 +42,10 @@ namespace fostgres {
     /// Register a responder with a const instance of this class
     struct responder {
         responder(fostlib::string name, responder_function);
+
+        /// Return the responder registered with the name. The function is
+        /// empty if no responder has that name
+        static responder_function find(f5::u8view name);
     };
 
 
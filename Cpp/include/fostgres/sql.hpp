@@ -17,6 +17,7 @@ namespace fostgres {
 
 
     struct match;
+    struct select_plan;
 
 
     /// Return a database connection configuration. Normally just use
@@ -51,12 +52,36 @@ namespace fostgres {
                 const fostlib::string &cmd,
                 const std::vector<fostlib::json> &args);
 
+    /// Execute the command with arguments for the matched end point. The
+    /// statement cache of the request's connection lease is used
+    std::pair<std::vector<fostlib::string>, fostlib::pg::recordset>
+            sql(fostlib::pg::connection &,
+                const match &,
+                const fostlib::string &cmd,
+                const std::vector<fostlib::string> &args);
+    std::pair<std::vector<fostlib::string>, fostlib::pg::recordset>
+            sql(fostlib::pg::connection &,
+                const match &,
+                const fostlib::string &cmd,
+                const std::vector<fostlib::json> &args);
+
     /// Return the data associated with a SELECT configuration (e.g. a GET)
     std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> select_data(
             fostlib::pg::connection &,
             const fostlib::json &select,
             const fostgres::match &m,
             const fostlib::http::server::request &req);
+    /// Return the SQL and arguments for a compiled SELECT configuration
+    std::pair<fostlib::string, std::vector<fostlib::json>> select_command(
+            const select_plan &select,
+            const fostgres::match &m,
+            const fostlib::http::server::request &req);
+    /// Return the data for a compiled SELECT configuration
+    std::pair<std::vector<fostlib::string>, fostlib::pg::recordset> select_data(
+            fostlib::pg::connection &,
+            const select_plan &select,
+            const fostgres::match &m,
+            const fostlib::http::server::request &req);
 
 
 }
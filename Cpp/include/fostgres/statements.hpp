@@ -0,0 +1,114 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#pragma once
+
+
+#include <fost/postgres>
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+
+
+namespace fostgres {
+
+
+    struct match;
+
+
+    /// A least recently used cache of the prepared statements made on a
+    /// single (pooled) database connection, keyed by the SQL text. The
+    /// cache must only be used with the connection it was created for.
+    class statement_cache {
+      public:
+        using procedure_type =
+                decltype(std::declval<fostlib::pg::connection &>().procedure(
+                        std::declval<const fostlib::utf8_string &>()));
+
+        /// The caches for the connections of a pool share a generation.
+        /// It goes up when one of them finds its statements are stale so
+        /// that the others throw theirs away too.
+        using generation_type = std::shared_ptr<std::atomic<std::size_t>>;
+
+        explicit statement_cache(
+                std::size_t capacity, generation_type generation = {});
+
+        /// Execute the SQL with the arguments. The statement is only
+        /// prepared if it isn't already in the cache.
+        fostlib::pg::recordset
+                exec(fostlib::pg::connection &,
+                     f5::u8view sql,
+                     const std::vector<fostlib::string> &args);
+        fostlib::pg::recordset
+                exec(fostlib::pg::connection &,
+                     f5::u8view sql,
+                     const std::vector<fostlib::json> &args);
+
+        /// The number of statements currently prepared
+        std::size_t size() const noexcept { return statements.size(); }
+        /// Forget all of the prepared statements, for example because the
+        /// server has thrown them away with `DISCARD ALL`
+        void clear();
+
+        /// Process wide counts of cache hits, misses and evictions
+        static fostlib::json statistics();
+
+        /// True if the error means the server no longer has (or can no
+        /// longer use) the statements prepared earlier. The cache has been
+        /// emptied, but the transaction has failed and the work has to be
+        /// started again.
+        static bool stale(const std::exception &);
+
+      private:
+        struct entry {
+            std::string sql;
+            procedure_type procedure;
+        };
+        using lru_type = std::list<entry>;
+
+        std::size_t capacity;
+        generation_type generation;
+        std::size_t seen = 0;
+        /// Most recently used statements are at the front
+        lru_type lru;
+        std::map<std::string_view, lru_type::iterator, std::less<>>
+                statements;
+
+        lru_type::iterator lookup(fostlib::pg::connection &, f5::u8view);
+        template<typename Args>
+        fostlib::pg::recordset
+                exec_impl(fostlib::pg::connection &, f5::u8view, const Args &);
+    };
+
+
+    /// Execute SQL with arguments
+    fostlib::pg::recordset
+            exec(fostlib::pg::connection &,
+                 f5::u8view sql,
+                 const std::vector<fostlib::string> &args);
+    fostlib::pg::recordset
+            exec(fostlib::pg::connection &,
+                 f5::u8view sql,
+                 const std::vector<fostlib::json> &args);
+    /// Execute SQL with arguments, using the statement cache of the
+    /// request's lease when the connection is the leased one
+    fostlib::pg::recordset
+            exec(fostlib::pg::connection &,
+                 const match &,
+                 f5::u8view sql,
+                 const std::vector<fostlib::string> &args);
+    fostlib::pg::recordset
+            exec(fostlib::pg::connection &,
+                 const match &,
+                 f5::u8view sql,
+                 const std::vector<fostlib::json> &args);
+
+
+}
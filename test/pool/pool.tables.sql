@@ -0,0 +1,6 @@
+CREATE TABLE pool_writes (
+    label text NOT NULL,
+    note text NOT NULL,
+    pid integer NOT NULL DEFAULT pg_backend_pid(),
+    CONSTRAINT pool_writes_pk PRIMARY KEY(label)
+);
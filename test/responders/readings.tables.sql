@@ -0,0 +1,13 @@
+CREATE TABLE readings (
+    id integer NOT NULL,
+    sensor text NOT NULL,
+    level integer NULL,
+    CONSTRAINT readings_pk PRIMARY KEY(id)
+);
+
+INSERT INTO readings (id, sensor, level) VALUES
+    (1, 'north', 10),
+    (2, 'north', NULL),
+    (3, 'south', 7),
+    (4, 'north', 12),
+    (5, 'south', 3);
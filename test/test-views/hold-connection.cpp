@@ -0,0 +1,38 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fostgres/pool.hpp>
+
+#include <fost/urlhandler>
+
+
+namespace {
+
+
+    /// Borrows a connection using the `connection` configuration and keeps
+    /// it while the `execute` view runs. Used to test what happens when a
+    /// pool has nothing left to lend.
+    const class hold_connection : public fostlib::urlhandler::view {
+      public:
+        hold_connection() : view("test.pool.hold") {}
+
+        std::pair<boost::shared_ptr<fostlib::mime>, int> operator()(
+                const fostlib::json &config,
+                const fostlib::string &path,
+                fostlib::http::server::request &req,
+                const fostlib::host &host) const {
+            fostgres::pooled_connection held{config["connection"], req};
+            auto response = execute(config["execute"], path, req, host);
+            held.release();
+            return response;
+        }
+
+    } c_hold_connection;
+
+
+}
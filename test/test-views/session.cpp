@@ -0,0 +1,24 @@
+/**
+    Copyright 2020 Red Anchor Trading Co. Ltd.
+
+    Distributed under the Boost Software License, Version 1.0.
+    See <http://www.boost.org/LICENSE_1_0.txt>
+ */
+
+
+#include <fostgres/callback.hpp>
+
+
+namespace {
+
+
+    /// Sets a session variable on every connection so that tests can
+    /// check that the connection set up is seen by the request's SQL
+    const fostgres::register_cnx_callback c_session{
+            [](fostlib::pg::connection &cnx,
+               const fostlib::http::server::request &) {
+                cnx.set_session("fg_test.callback", "ran");
+            }};
+
+
+}